@@ -0,0 +1,356 @@
+
+// Dynamic AABB tree for objects that move every frame. Leaves store bounds
+// grown by a margin so small moves don't touch the tree, inserts pick the
+// sibling with the smallest surface area increase and rotations keep the
+// tree balanced.
+
+#define AABB_TREE_NULL (~0u)
+#define AABB_TREE_STACK_SIZE 256
+
+struct Aabb_Tree_Node
+{
+	Aabb bounds;
+
+	// Next free node while on the free list
+	U32 parent;
+
+	// AABB_TREE_NULL for leaves
+	U32 children[2];
+
+	U32 height;
+	U32 user;
+};
+
+struct Aabb_Tree
+{
+	Aabb_Tree_Node *nodes;
+	U32 node_capacity;
+
+	U32 root;
+	U32 free_list;
+
+	float margin;
+};
+
+void aabb_tree_init(Aabb_Tree *tree, float margin)
+{
+	memset(tree, 0, sizeof(Aabb_Tree));
+	tree->root = AABB_TREE_NULL;
+	tree->free_list = AABB_TREE_NULL;
+	tree->margin = margin;
+}
+
+void aabb_tree_free(Aabb_Tree *tree)
+{
+	free(tree->nodes);
+	aabb_tree_init(tree, tree->margin);
+}
+
+static bool aabb_tree_is_leaf(const Aabb_Tree_Node *node)
+{
+	return node->children[0] == AABB_TREE_NULL;
+}
+
+static U32 aabb_tree_alloc_node(Aabb_Tree *tree)
+{
+	if (tree->free_list == AABB_TREE_NULL) {
+		U32 capacity = tree->node_capacity ? tree->node_capacity * 2 : 16;
+		Aabb_Tree_Node *nodes = (Aabb_Tree_Node*)realloc(tree->nodes, sizeof(Aabb_Tree_Node) * capacity);
+		if (!nodes)
+			return AABB_TREE_NULL;
+
+		for (U32 i = tree->node_capacity; i < capacity; i++)
+			nodes[i].parent = i + 1 < capacity ? i + 1 : AABB_TREE_NULL;
+
+		tree->free_list = tree->node_capacity;
+		tree->nodes = nodes;
+		tree->node_capacity = capacity;
+	}
+
+	U32 index = tree->free_list;
+	Aabb_Tree_Node *node = &tree->nodes[index];
+	tree->free_list = node->parent;
+
+	node->parent = AABB_TREE_NULL;
+	node->children[0] = AABB_TREE_NULL;
+	node->children[1] = AABB_TREE_NULL;
+	node->height = 0;
+	node->user = 0;
+	return index;
+}
+
+static void aabb_tree_free_node(Aabb_Tree *tree, U32 index)
+{
+	tree->nodes[index].parent = tree->free_list;
+	tree->free_list = index;
+}
+
+static Aabb aabb_tree_fatten(const Aabb_Tree *tree, const Aabb& bounds)
+{
+	Vec3 margin = vec3(tree->margin, tree->margin, tree->margin);
+	Aabb ret;
+	ret.min = bounds.min - margin;
+	ret.max = bounds.max + margin;
+	return ret;
+}
+
+static void aabb_tree_refresh(Aabb_Tree *tree, U32 index)
+{
+	Aabb_Tree_Node *node = &tree->nodes[index];
+	const Aabb_Tree_Node *a = &tree->nodes[node->children[0]];
+	const Aabb_Tree_Node *b = &tree->nodes[node->children[1]];
+	node->bounds = aabb_union(a->bounds, b->bounds);
+	node->height = 1 + (a->height > b->height ? a->height : b->height);
+}
+
+// Rotates the taller child of `index` above it if the children differ in
+// height by more than one, returns the node now in its place
+static U32 aabb_tree_balance(Aabb_Tree *tree, U32 index)
+{
+	Aabb_Tree_Node *a = &tree->nodes[index];
+	if (aabb_tree_is_leaf(a) || a->height < 2)
+		return index;
+
+	U32 h0 = tree->nodes[a->children[0]].height;
+	U32 h1 = tree->nodes[a->children[1]].height;
+	if (h0 <= h1 + 1 && h1 <= h0 + 1)
+		return index;
+
+	// Side of the child that moves up
+	U32 side = h1 > h0 ? 1 : 0;
+	U32 up_index = a->children[side];
+	Aabb_Tree_Node *up = &tree->nodes[up_index];
+
+	U32 tall = up->children[0], short_ = up->children[1];
+	if (tree->nodes[tall].height < tree->nodes[short_].height) {
+		tall = up->children[1];
+		short_ = up->children[0];
+	}
+
+	// `up` replaces `a` under the old parent
+	up->parent = a->parent;
+	if (up->parent != AABB_TREE_NULL) {
+		Aabb_Tree_Node *parent = &tree->nodes[up->parent];
+		parent->children[parent->children[0] == index ? 0 : 1] = up_index;
+	} else {
+		tree->root = up_index;
+	}
+
+	// `a` keeps the shorter grandchild in place of `up`
+	up->children[0] = index;
+	up->children[1] = tall;
+	a->parent = up_index;
+	a->children[side] = short_;
+	tree->nodes[short_].parent = index;
+
+	aabb_tree_refresh(tree, index);
+	aabb_tree_refresh(tree, up_index);
+	return up_index;
+}
+
+// Fixes bounds and heights from `index` to the root
+static void aabb_tree_fix_upwards(Aabb_Tree *tree, U32 index)
+{
+	while (index != AABB_TREE_NULL) {
+		index = aabb_tree_balance(tree, index);
+		aabb_tree_refresh(tree, index);
+		index = tree->nodes[index].parent;
+	}
+}
+
+static bool aabb_tree_insert_leaf(Aabb_Tree *tree, U32 leaf)
+{
+	if (tree->root == AABB_TREE_NULL) {
+		tree->root = leaf;
+		tree->nodes[leaf].parent = AABB_TREE_NULL;
+		return true;
+	}
+
+	// Allocate first, this may move the nodes
+	U32 new_parent = aabb_tree_alloc_node(tree);
+	if (new_parent == AABB_TREE_NULL)
+		return false;
+
+	Aabb bounds = tree->nodes[leaf].bounds;
+
+	// Descend towards the cheapest sibling, a child is only worth it if the
+	// cost of going through it is lower than pairing with this node
+	U32 index = tree->root;
+	while (!aabb_tree_is_leaf(&tree->nodes[index])) {
+		const Aabb_Tree_Node *node = &tree->nodes[index];
+		float area = aabb_surface_area(node->bounds);
+		float combined = aabb_surface_area(aabb_union(node->bounds, bounds));
+
+		float cost = 2.0f * combined;
+		float inherited = 2.0f * (combined - area);
+
+		float child_cost[2];
+		for (U32 i = 0; i < 2; i++) {
+			const Aabb_Tree_Node *child = &tree->nodes[node->children[i]];
+			float grown = aabb_surface_area(aabb_union(child->bounds, bounds));
+			if (!aabb_tree_is_leaf(child))
+				grown -= aabb_surface_area(child->bounds);
+			child_cost[i] = grown + inherited;
+		}
+
+		if (cost < child_cost[0] && cost < child_cost[1])
+			break;
+
+		index = node->children[child_cost[0] < child_cost[1] ? 0 : 1];
+	}
+
+	U32 sibling = index;
+	U32 old_parent = tree->nodes[sibling].parent;
+
+	Aabb_Tree_Node *parent = &tree->nodes[new_parent];
+	parent->parent = old_parent;
+	parent->children[0] = sibling;
+	parent->children[1] = leaf;
+	tree->nodes[sibling].parent = new_parent;
+	tree->nodes[leaf].parent = new_parent;
+
+	if (old_parent != AABB_TREE_NULL) {
+		Aabb_Tree_Node *p = &tree->nodes[old_parent];
+		p->children[p->children[0] == sibling ? 0 : 1] = new_parent;
+	} else {
+		tree->root = new_parent;
+	}
+
+	aabb_tree_fix_upwards(tree, new_parent);
+	return true;
+}
+
+static void aabb_tree_remove_leaf(Aabb_Tree *tree, U32 leaf)
+{
+	if (leaf == tree->root) {
+		tree->root = AABB_TREE_NULL;
+		return;
+	}
+
+	U32 parent = tree->nodes[leaf].parent;
+	Aabb_Tree_Node *p = &tree->nodes[parent];
+	U32 sibling = p->children[p->children[0] == leaf ? 1 : 0];
+	U32 grand_parent = p->parent;
+
+	// The sibling takes the place of the parent
+	tree->nodes[sibling].parent = grand_parent;
+	aabb_tree_free_node(tree, parent);
+
+	if (grand_parent != AABB_TREE_NULL) {
+		Aabb_Tree_Node *g = &tree->nodes[grand_parent];
+		g->children[g->children[0] == parent ? 0 : 1] = sibling;
+		aabb_tree_fix_upwards(tree, grand_parent);
+	} else {
+		tree->root = sibling;
+	}
+}
+
+// Returns the proxy for the object, AABB_TREE_NULL if out of memory
+U32 aabb_tree_insert(Aabb_Tree *tree, const Aabb& bounds, U32 user)
+{
+	U32 leaf = aabb_tree_alloc_node(tree);
+	if (leaf == AABB_TREE_NULL)
+		return AABB_TREE_NULL;
+
+	Aabb_Tree_Node *node = &tree->nodes[leaf];
+	node->bounds = aabb_tree_fatten(tree, bounds);
+	node->user = user;
+
+	if (!aabb_tree_insert_leaf(tree, leaf)) {
+		aabb_tree_free_node(tree, leaf);
+		return AABB_TREE_NULL;
+	}
+	return leaf;
+}
+
+void aabb_tree_remove(Aabb_Tree *tree, U32 proxy)
+{
+	aabb_tree_remove_leaf(tree, proxy);
+	aabb_tree_free_node(tree, proxy);
+}
+
+// Updates the bounds of a proxy, the tree only changes if the new bounds
+// leave the fattened ones. Returns true if the proxy was reinserted.
+bool aabb_tree_move(Aabb_Tree *tree, U32 proxy, const Aabb& bounds)
+{
+	Aabb_Tree_Node *node = &tree->nodes[proxy];
+	Aabb fat = node->bounds;
+	if (fat.min.x <= bounds.min.x && fat.min.y <= bounds.min.y && fat.min.z <= bounds.min.z &&
+		fat.max.x >= bounds.max.x && fat.max.y >= bounds.max.y && fat.max.z >= bounds.max.z)
+		return false;
+
+	aabb_tree_remove_leaf(tree, proxy);
+	tree->nodes[proxy].bounds = aabb_tree_fatten(tree, bounds);
+
+	// Removing freed a node, so reinserting can't run out of memory
+	bool ok = aabb_tree_insert_leaf(tree, proxy);
+	assert(ok);
+	return true;
+}
+
+// Writes the user values of proxies whose fattened bounds the ray enters
+// before t_max, returns the number written
+U32 aabb_tree_query_ray(const Aabb_Tree *tree, const Ray& ray, float t_max, U32 *users, U32 max_count)
+{
+	if (tree->root == AABB_TREE_NULL)
+		return 0;
+
+	Vec3 inv_dir = bvh_inverse_direction(ray.direction);
+
+	U32 stack[AABB_TREE_STACK_SIZE];
+	U32 stack_size = 0;
+	stack[stack_size++] = tree->root;
+
+	U32 count = 0;
+	while (stack_size > 0) {
+		const Aabb_Tree_Node *node = &tree->nodes[stack[--stack_size]];
+		if (bvh_ray_aabb(node->bounds, ray.origin, inv_dir, t_max) == FLT_MAX)
+			continue;
+
+		if (aabb_tree_is_leaf(node)) {
+			if (count == max_count)
+				break;
+			users[count++] = node->user;
+			continue;
+		}
+
+		assert(stack_size + 2 <= AABB_TREE_STACK_SIZE);
+		stack[stack_size++] = node->children[0];
+		stack[stack_size++] = node->children[1];
+	}
+
+	return count;
+}
+
+// Writes the user values of proxies whose fattened bounds overlap `bounds`
+U32 aabb_tree_query_aabb(const Aabb_Tree *tree, const Aabb& bounds, U32 *users, U32 max_count)
+{
+	if (tree->root == AABB_TREE_NULL)
+		return 0;
+
+	U32 stack[AABB_TREE_STACK_SIZE];
+	U32 stack_size = 0;
+	stack[stack_size++] = tree->root;
+
+	U32 count = 0;
+	while (stack_size > 0) {
+		const Aabb_Tree_Node *node = &tree->nodes[stack[--stack_size]];
+		const Aabb& b = node->bounds;
+		if (b.min.x > bounds.max.x || b.min.y > bounds.max.y || b.min.z > bounds.max.z ||
+			b.max.x < bounds.min.x || b.max.y < bounds.min.y || b.max.z < bounds.min.z)
+			continue;
+
+		if (aabb_tree_is_leaf(node)) {
+			if (count == max_count)
+				break;
+			users[count++] = node->user;
+			continue;
+		}
+
+		assert(stack_size + 2 <= AABB_TREE_STACK_SIZE);
+		stack[stack_size++] = node->children[0];
+		stack[stack_size++] = node->children[1];
+	}
+
+	return count;
+}
@@ -0,0 +1,1015 @@
+
+// Benchmark and accuracy harness for the math kernels, runs without a window
+// or GL context. Accuracy is the maximum error against a double precision
+// reference in ULPs of the largest element of each output, so cancellation
+// towards zero in a single element doesn't dominate.
+// Usage: bench [-n iterations] [-p scalar|sse2|sse41|avx|avx2|avx512] [-j results.json]
+
+#define BENCH_MAX_SIZE 65536
+#define BENCH_SINGLE_COUNT 1024
+#define BENCH_ACCURACY_COUNT 4096
+#define BENCH_RUNS 3
+
+static const U32 bench_sizes[] = { 16, 256, 4096, BENCH_MAX_SIZE };
+
+struct Bench_Result
+{
+	char name[48];
+	const char *path;
+	U32 size;
+	double ns_per_op;
+
+	// Negative when there is no reference
+	double max_ulp;
+};
+
+#define BENCH_MAX_RESULTS 512
+
+Bench_Result bench_results[BENCH_MAX_RESULTS];
+U32 bench_result_count;
+
+// Elements processed per case are about `bench_iterations * BENCH_SINGLE_COUNT`
+U32 bench_iterations = 100;
+
+Mat44 bench_a[BENCH_MAX_SIZE];
+Mat44 bench_b[BENCH_MAX_SIZE];
+Mat44 bench_general[BENCH_MAX_SIZE];
+Mat44 bench_out[BENCH_MAX_SIZE];
+
+Mat34 bench_a34[BENCH_MAX_SIZE];
+Mat34 bench_b34[BENCH_MAX_SIZE];
+Mat34 bench_out34[BENCH_MAX_SIZE];
+Mat33 bench_out33[BENCH_MAX_SIZE];
+
+Trs bench_trs[BENCH_MAX_SIZE];
+U32 bench_parent[BENCH_MAX_SIZE];
+Dual_Quat bench_dq[BENCH_MAX_SIZE];
+
+Vec3 bench_points[BENCH_MAX_SIZE];
+Vec3 bench_points_out[BENCH_MAX_SIZE];
+float bench_x[BENCH_MAX_SIZE], bench_y[BENCH_MAX_SIZE], bench_z[BENCH_MAX_SIZE];
+float bench_ox[BENCH_MAX_SIZE], bench_oy[BENCH_MAX_SIZE], bench_oz[BENCH_MAX_SIZE];
+
+float bench_scalars[BENCH_MAX_SIZE];
+
+// Reference results, `BENCH_ACCURACY_COUNT` outputs of up to 16 elements
+double bench_ref[BENCH_ACCURACY_COUNT * 16];
+float bench_values[BENCH_ACCURACY_COUNT * 16];
+
+float bench_random()
+{
+	return (float)rand() / (float)RAND_MAX * 2.0f - 1.0f;
+}
+
+Vec3 bench_random_vec3()
+{
+	return vec3(bench_random(), bench_random(), bench_random());
+}
+
+// Random well conditioned matrix: rotation with scale and translation
+Mat44 bench_random_matrix()
+{
+	Vec3 axis = vec3(bench_random(), bench_random(), bench_random() + 2.0f);
+	Mat44 m = mat44_rotate_axis(axis, bench_random() * FLT_PI);
+	m *= mat44_scale(vec3(1.5f + bench_random(), 1.5f + bench_random(), 1.5f + bench_random()));
+	m *= mat44_translate(bench_random_vec3() * 10.0f);
+	return m;
+}
+
+// Timing
+
+void bench_add(const char *name, const char *path, U32 size, U64 ticks, U32 ops, double max_ulp)
+{
+	assert(bench_result_count < BENCH_MAX_RESULTS);
+	Bench_Result *r = &bench_results[bench_result_count++];
+
+	strncpy(r->name, name, sizeof(r->name) - 1);
+	r->name[sizeof(r->name) - 1] = '\0';
+	r->path = path;
+	r->size = size;
+	r->ns_per_op = timer_seconds(ticks) * 1e9 / (double)ops;
+	r->max_ulp = max_ulp;
+
+	printf("%-24s %-8s %6u %8.2f ns/op", r->name, r->path, r->size, r->ns_per_op);
+	if (max_ulp >= 0.0)
+		printf(" %10.2f ulp\n", max_ulp);
+	else
+		printf("\n");
+}
+
+U32 bench_reps(U32 size)
+{
+	U32 reps = bench_iterations * BENCH_SINGLE_COUNT / size;
+	return reps > 0 ? reps : 1;
+}
+
+// Best of BENCH_RUNS runs of `reps` repetitions of `stmt`
+#define BENCH_TIME(ticks, reps, stmt) do { \
+		U64 best_ = ~0ull; \
+		for (U32 run_ = 0; run_ < BENCH_RUNS; run_++) { \
+			U64 begin_ = timer_ticks(); \
+			for (U32 rep_ = 0; rep_ < (reps); rep_++) { stmt; } \
+			U64 elapsed_ = timer_ticks() - begin_; \
+			if (elapsed_ < best_) best_ = elapsed_; \
+		} \
+		ticks = best_; \
+	} while (0)
+
+// Accuracy
+
+double bench_ulp(double magnitude)
+{
+	int exponent;
+	frexp(magnitude, &exponent);
+	return ldexp(1.0, exponent - 24);
+}
+
+// Max error of `count` outputs of `group` elements each
+double bench_max_ulp(const float *values, const double *ref, U32 count, U32 group)
+{
+	double max_ulp = 0.0;
+	for (U32 i = 0; i < count; i++) {
+		const float *v = values + i * group;
+		const double *r = ref + i * group;
+
+		double magnitude = 0.0;
+		for (U32 c = 0; c < group; c++)
+			magnitude = fabs(r[c]) > magnitude ? fabs(r[c]) : magnitude;
+		if (magnitude == 0.0)
+			magnitude = 1.0;
+
+		double ulp = bench_ulp(magnitude);
+		for (U32 c = 0; c < group; c++) {
+			double err = fabs((double)v[c] - r[c]) / ulp;
+			if (err > max_ulp) max_ulp = err;
+		}
+	}
+	return max_ulp;
+}
+
+// Double precision references, matrices are expanded to 4x4
+
+void ref_load(double *d, const float *m, U32 rows)
+{
+	for (U32 i = 0; i < 16; i++)
+		d[i] = i < rows * 4 ? (double)m[i] : (i == 15 ? 1.0 : 0.0);
+}
+
+// Same convention as `operator*`: `a` applied first
+void ref_mul(double *r, const double *a, const double *b)
+{
+	for (U32 i = 0; i < 4; i++) {
+		for (U32 j = 0; j < 4; j++) {
+			double sum = 0.0;
+			for (U32 k = 0; k < 4; k++)
+				sum += b[i*4 + k] * a[k*4 + j];
+			r[i*4 + j] = sum;
+		}
+	}
+}
+
+// Gauss-Jordan with partial pivoting, returns the determinant
+double ref_inverse(double *r, const double *m)
+{
+	double a[16];
+	memcpy(a, m, sizeof(a));
+	for (U32 i = 0; i < 16; i++)
+		r[i] = (i % 5 == 0) ? 1.0 : 0.0;
+
+	double det = 1.0;
+	for (U32 c = 0; c < 4; c++) {
+		U32 pivot = c;
+		for (U32 i = c + 1; i < 4; i++) {
+			if (fabs(a[i*4 + c]) > fabs(a[pivot*4 + c]))
+				pivot = i;
+		}
+		if (pivot != c) {
+			for (U32 j = 0; j < 4; j++) {
+				double t = a[c*4 + j]; a[c*4 + j] = a[pivot*4 + j]; a[pivot*4 + j] = t;
+				t = r[c*4 + j]; r[c*4 + j] = r[pivot*4 + j]; r[pivot*4 + j] = t;
+			}
+			det = -det;
+		}
+
+		double p = a[c*4 + c];
+		det *= p;
+		for (U32 j = 0; j < 4; j++) {
+			a[c*4 + j] /= p;
+			r[c*4 + j] /= p;
+		}
+
+		for (U32 i = 0; i < 4; i++) {
+			if (i == c) continue;
+			double f = a[i*4 + c];
+			for (U32 j = 0; j < 4; j++) {
+				a[i*4 + j] -= f * a[c*4 + j];
+				r[i*4 + j] -= f * r[c*4 + j];
+			}
+		}
+	}
+	return det;
+}
+
+void ref_transform(double *r, const double *m, const Vec3& v, double w)
+{
+	for (U32 i = 0; i < 3; i++)
+		r[i] = m[i*4 + 0]*v.x + m[i*4 + 1]*v.y + m[i*4 + 2]*v.z + m[i*4 + 3]*w;
+}
+
+void ref_lookat(double *r, const Vec3& eye, const Vec3& target, const Vec3& up)
+{
+	double f[3] = { (double)target.x - eye.x, (double)target.y - eye.y, (double)target.z - eye.z };
+	double fl = sqrt(f[0]*f[0] + f[1]*f[1] + f[2]*f[2]);
+	for (U32 i = 0; i < 3; i++) f[i] /= fl;
+
+	double s[3] = { f[1]*up.z - f[2]*up.y, f[2]*up.x - f[0]*up.z, f[0]*up.y - f[1]*up.x };
+	double sl = sqrt(s[0]*s[0] + s[1]*s[1] + s[2]*s[2]);
+	for (U32 i = 0; i < 3; i++) s[i] /= sl;
+
+	double u[3] = { s[1]*f[2] - s[2]*f[1], s[2]*f[0] - s[0]*f[2], s[0]*f[1] - s[1]*f[0] };
+	double e[3] = { eye.x, eye.y, eye.z };
+
+	double rows[3][3] = {
+		{ s[0], s[1], s[2] },
+		{ u[0], u[1], u[2] },
+		{ -f[0], -f[1], -f[2] },
+	};
+	for (U32 i = 0; i < 3; i++) {
+		r[i*4 + 0] = rows[i][0];
+		r[i*4 + 1] = rows[i][1];
+		r[i*4 + 2] = rows[i][2];
+		r[i*4 + 3] = -(rows[i][0]*e[0] + rows[i][1]*e[1] + rows[i][2]*e[2]);
+	}
+	r[12] = 0.0; r[13] = 0.0; r[14] = 0.0; r[15] = 1.0;
+}
+
+void ref_trs(double *r, const Trs& t)
+{
+	double x = t.rotation.x, y = t.rotation.y, z = t.rotation.z, w = t.rotation.w;
+	double rot[9] = {
+		1.0 - 2.0*(y*y + z*z), 2.0*(x*y - w*z), 2.0*(x*z + w*y),
+		2.0*(x*y + w*z), 1.0 - 2.0*(x*x + z*z), 2.0*(y*z - w*x),
+		2.0*(x*z - w*y), 2.0*(y*z + w*x), 1.0 - 2.0*(x*x + y*y),
+	};
+	double s[3] = { t.scale.x, t.scale.y, t.scale.z };
+	double tr[3] = { t.translation.x, t.translation.y, t.translation.z };
+
+	for (U32 i = 0; i < 3; i++) {
+		for (U32 j = 0; j < 3; j++)
+			r[i*4 + j] = rot[i*3 + j] * s[j];
+		r[i*4 + 3] = tr[i];
+	}
+	r[12] = 0.0; r[13] = 0.0; r[14] = 0.0; r[15] = 1.0;
+}
+
+// Inverse transpose of the 3x3 part
+void ref_normal_matrix(double *r, const double *m)
+{
+	double inv[16];
+	double a[16];
+	memcpy(a, m, sizeof(a));
+	a[3] = 0.0; a[7] = 0.0; a[11] = 0.0;
+	ref_inverse(inv, a);
+	for (U32 i = 0; i < 3; i++) {
+		for (U32 j = 0; j < 3; j++)
+			r[i*3 + j] = inv[j*4 + i];
+	}
+}
+
+// Cases
+
+void bench_setup()
+{
+	srand(1);
+	for (U32 i = 0; i < BENCH_MAX_SIZE; i++) {
+		bench_a[i] = bench_random_matrix();
+		bench_b[i] = bench_random_matrix();
+
+		// Projective last row, so the full 4x4 paths are exercised
+		bench_general[i] = bench_random_matrix();
+		bench_general[i]._41 = bench_random() * 0.01f;
+		bench_general[i]._42 = bench_random() * 0.01f;
+		bench_general[i]._43 = bench_random() * 0.01f;
+
+		bench_a34[i] = mat34(bench_a[i]);
+		bench_b34[i] = mat34(bench_b[i]);
+
+		float s = 1.5f + bench_random();
+		bench_trs[i] = trs(quat_axis_angle(vec3(bench_random(), bench_random(), bench_random() + 2.0f), bench_random() * FLT_PI),
+			bench_random_vec3() * 10.0f, vec3(s, s, s));
+		bench_parent[i] = i > 0 ? (U32)(rand() % i) : ~0u;
+
+		bench_points[i] = bench_random_vec3() * 10.0f;
+		bench_x[i] = bench_points[i].x;
+		bench_y[i] = bench_points[i].y;
+		bench_z[i] = bench_points[i].z;
+	}
+}
+
+typedef Mat44 (*bench_mat44_unary)(const Mat44& a);
+typedef Mat44 (*bench_mat44_binary)(const Mat44& a, const Mat44& b);
+typedef Mat34 (*bench_mat34_binary)(const Mat34& a, const Mat34& b);
+typedef Mat34 (*bench_trs_convert)(const Trs& t);
+
+void bench_mat44_mul(const char *path, bench_mat44_binary func)
+{
+	U64 ticks;
+	BENCH_TIME(ticks, bench_iterations, {
+		for (U32 i = 0; i < BENCH_SINGLE_COUNT; i++)
+			bench_out[i] = func(bench_a[i], bench_b[i]);
+	});
+
+	for (U32 i = 0; i < BENCH_ACCURACY_COUNT; i++) {
+		double a[16], b[16];
+		ref_load(a, bench_general[i].data, 4);
+		ref_load(b, bench_b[i].data, 4);
+		ref_mul(bench_ref + i * 16, a, b);
+		Mat44 r = func(bench_general[i], bench_b[i]);
+		memcpy(bench_values + i * 16, r.data, sizeof(r.data));
+	}
+	double ulp = bench_max_ulp(bench_values, bench_ref, BENCH_ACCURACY_COUNT, 16);
+
+	bench_add("mat44 mul", path, 1, ticks, bench_iterations * BENCH_SINGLE_COUNT, ulp);
+}
+
+void bench_mat44_inverse(const char *path, bench_mat44_unary func)
+{
+	U64 ticks;
+	BENCH_TIME(ticks, bench_iterations, {
+		for (U32 i = 0; i < BENCH_SINGLE_COUNT; i++)
+			bench_out[i] = func(bench_general[i]);
+	});
+
+	for (U32 i = 0; i < BENCH_ACCURACY_COUNT; i++) {
+		double m[16];
+		ref_load(m, bench_general[i].data, 4);
+		ref_inverse(bench_ref + i * 16, m);
+		Mat44 r = func(bench_general[i]);
+		memcpy(bench_values + i * 16, r.data, sizeof(r.data));
+	}
+	double ulp = bench_max_ulp(bench_values, bench_ref, BENCH_ACCURACY_COUNT, 16);
+
+	bench_add("mat44 inverse", path, 1, ticks, bench_iterations * BENCH_SINGLE_COUNT, ulp);
+}
+
+void bench_mat44_transpose(const char *path, bench_mat44_unary func)
+{
+	U64 ticks;
+	BENCH_TIME(ticks, bench_iterations, {
+		for (U32 i = 0; i < BENCH_SINGLE_COUNT; i++)
+			bench_out[i] = func(bench_a[i]);
+	});
+
+	for (U32 i = 0; i < BENCH_ACCURACY_COUNT; i++) {
+		Mat44 r = func(bench_general[i]);
+		for (U32 c = 0; c < 16; c++) {
+			bench_ref[i*16 + c] = bench_general[i].data[(c % 4) * 4 + c / 4];
+			bench_values[i*16 + c] = r.data[c];
+		}
+	}
+	double ulp = bench_max_ulp(bench_values, bench_ref, BENCH_ACCURACY_COUNT, 16);
+
+	bench_add("mat44 transpose", path, 1, ticks, bench_iterations * BENCH_SINGLE_COUNT, ulp);
+}
+
+void bench_mat34_mul(const char *path, bench_mat34_binary func)
+{
+	U64 ticks;
+	BENCH_TIME(ticks, bench_iterations, {
+		for (U32 i = 0; i < BENCH_SINGLE_COUNT; i++)
+			bench_out34[i] = func(bench_a34[i], bench_b34[i]);
+	});
+
+	for (U32 i = 0; i < BENCH_ACCURACY_COUNT; i++) {
+		double a[16], b[16], r[16];
+		ref_load(a, bench_a34[i].data, 3);
+		ref_load(b, bench_b34[i].data, 3);
+		ref_mul(r, a, b);
+		memcpy(bench_ref + i * 12, r, sizeof(double) * 12);
+		Mat34 m = func(bench_a34[i], bench_b34[i]);
+		memcpy(bench_values + i * 12, m.data, sizeof(m.data));
+	}
+	double ulp = bench_max_ulp(bench_values, bench_ref, BENCH_ACCURACY_COUNT, 12);
+
+	bench_add("mat34 mul", path, 1, ticks, bench_iterations * BENCH_SINGLE_COUNT, ulp);
+}
+
+void bench_trs_to_mat34(const char *path, bench_trs_convert func)
+{
+	U64 ticks;
+	BENCH_TIME(ticks, bench_iterations, {
+		for (U32 i = 0; i < BENCH_SINGLE_COUNT; i++)
+			bench_out34[i] = func(bench_trs[i]);
+	});
+
+	for (U32 i = 0; i < BENCH_ACCURACY_COUNT; i++) {
+		double r[16];
+		ref_trs(r, bench_trs[i]);
+		memcpy(bench_ref + i * 12, r, sizeof(double) * 12);
+		Mat34 m = func(bench_trs[i]);
+		memcpy(bench_values + i * 12, m.data, sizeof(m.data));
+	}
+	double ulp = bench_max_ulp(bench_values, bench_ref, BENCH_ACCURACY_COUNT, 12);
+
+	bench_add("trs to mat34", path, 1, ticks, bench_iterations * BENCH_SINGLE_COUNT, ulp);
+}
+
+void bench_single_ops()
+{
+	U64 ticks;
+	U32 ops = bench_iterations * BENCH_SINGLE_COUNT;
+
+	bench_mat44_mul("scalar", mat44_mul_scalar);
+#ifdef HAS_SSE2
+	bench_mat44_mul("sse2", mat44_mul_sse2);
+#endif
+#ifdef HAS_DISPATCH_AVX
+	if (cpu_path() >= Cpu_Path_AVX)
+		bench_mat44_mul("avx", mat44_mul_avx);
+#endif
+
+	bench_mat44_inverse("scalar", mat44_inverse_scalar);
+#ifdef HAS_SSE2
+	bench_mat44_inverse("sse2", mat44_inverse_sse2);
+#endif
+
+	bench_mat44_transpose("scalar", mat44_transpose_scalar);
+#ifdef HAS_SSE2
+	bench_mat44_transpose("sse2", mat44_transpose_sse2);
+#endif
+
+	{
+		BENCH_TIME(ticks, bench_iterations, {
+			for (U32 i = 0; i < BENCH_SINGLE_COUNT; i++)
+				bench_scalars[i] = determinant(bench_general[i]);
+		});
+
+		for (U32 i = 0; i < BENCH_ACCURACY_COUNT; i++) {
+			double m[16], inv[16];
+			ref_load(m, bench_general[i].data, 4);
+			bench_ref[i] = ref_inverse(inv, m);
+			bench_values[i] = determinant(bench_general[i]);
+		}
+		bench_add("mat44 determinant", "default", 1, ticks, ops,
+			bench_max_ulp(bench_values, bench_ref, BENCH_ACCURACY_COUNT, 1));
+	}
+
+	{
+		BENCH_TIME(ticks, bench_iterations, {
+			for (U32 i = 0; i < BENCH_SINGLE_COUNT; i++)
+				bench_out[i] = mat44_lookat(bench_points[i], bench_points[i + 1], vec3(0.0f, 1.0f, 0.0f));
+		});
+
+		for (U32 i = 0; i < BENCH_ACCURACY_COUNT; i++) {
+			ref_lookat(bench_ref + i * 16, bench_points[i], bench_points[i + 1], vec3(0.0f, 1.0f, 0.0f));
+			Mat44 r = mat44_lookat(bench_points[i], bench_points[i + 1], vec3(0.0f, 1.0f, 0.0f));
+			memcpy(bench_values + i * 16, r.data, sizeof(r.data));
+		}
+		bench_add("mat44_lookat", "default", 1, ticks, ops,
+			bench_max_ulp(bench_values, bench_ref, BENCH_ACCURACY_COUNT, 16));
+	}
+
+	{
+		BENCH_TIME(ticks, bench_iterations, {
+			for (U32 i = 0; i < BENCH_SINGLE_COUNT; i++)
+				bench_points_out[i] = bench_points[i] * bench_a[i];
+		});
+
+		for (U32 i = 0; i < BENCH_ACCURACY_COUNT; i++) {
+			double m[16];
+			ref_load(m, bench_a[i].data, 4);
+			ref_transform(bench_ref + i * 3, m, bench_points[i], 1.0);
+			Vec3 r = bench_points[i] * bench_a[i];
+			memcpy(bench_values + i * 3, &r, sizeof(r));
+		}
+		bench_add("vec3 * mat44", "default", 1, ticks, ops,
+			bench_max_ulp(bench_values, bench_ref, BENCH_ACCURACY_COUNT, 3));
+	}
+
+	bench_mat34_mul("scalar", mat34_mul_scalar);
+#ifdef HAS_SSE2
+	bench_mat34_mul("sse2", mat34_mul_sse2);
+#endif
+
+	{
+		BENCH_TIME(ticks, bench_iterations, {
+			for (U32 i = 0; i < BENCH_SINGLE_COUNT; i++)
+				bench_out34[i] = inverse(bench_a34[i]);
+		});
+
+		for (U32 i = 0; i < BENCH_ACCURACY_COUNT; i++) {
+			double m[16], r[16];
+			ref_load(m, bench_a34[i].data, 3);
+			ref_inverse(r, m);
+			memcpy(bench_ref + i * 12, r, sizeof(double) * 12);
+			Mat34 inv = inverse(bench_a34[i]);
+			memcpy(bench_values + i * 12, inv.data, sizeof(inv.data));
+		}
+		bench_add("mat34 inverse", "default", 1, ticks, ops,
+			bench_max_ulp(bench_values, bench_ref, BENCH_ACCURACY_COUNT, 12));
+	}
+
+	bench_trs_to_mat34("scalar", mat34_from_trs_scalar);
+#ifdef HAS_SSE2
+	bench_trs_to_mat34("sse2", mat34_from_trs_sse2);
+#endif
+}
+
+// Dispatched batch kernels on every path up to the active one
+void bench_dispatched_kernels()
+{
+	Cpu_Path active = cpu_path();
+
+	for (U32 p = 0; p <= (U32)active; p++) {
+		Math_Kernels k;
+		math_select_kernels(&k, (Cpu_Path)p);
+		const char *path = cpu_path_names[p];
+
+		for (U32 i = 0; i < BENCH_ACCURACY_COUNT; i++) {
+			double m[16];
+			ref_load(m, bench_a[0].data, 4);
+			ref_transform(bench_ref + i * 3, m, bench_points[i], 1.0);
+		}
+
+		k.transform_aos(bench_points_out, bench_points, BENCH_ACCURACY_COUNT, bench_a[0], 1.0f);
+		double aos_ulp = bench_max_ulp((const float*)bench_points_out, bench_ref, BENCH_ACCURACY_COUNT, 3);
+
+		k.transform_soa(bench_ox, bench_oy, bench_oz, bench_x, bench_y, bench_z, BENCH_ACCURACY_COUNT, bench_a[0], 1.0f);
+		for (U32 i = 0; i < BENCH_ACCURACY_COUNT; i++) {
+			bench_values[i*3 + 0] = bench_ox[i];
+			bench_values[i*3 + 1] = bench_oy[i];
+			bench_values[i*3 + 2] = bench_oz[i];
+		}
+		double soa_ulp = bench_max_ulp(bench_values, bench_ref, BENCH_ACCURACY_COUNT, 3);
+
+		k.mat44_mul_batch(bench_out, bench_a, bench_b, 0, BENCH_ACCURACY_COUNT);
+		for (U32 i = 0; i < BENCH_ACCURACY_COUNT; i++) {
+			double a[16], b[16];
+			ref_load(a, bench_a[i].data, 4);
+			ref_load(b, bench_b[i].data, 4);
+			ref_mul(bench_ref + i * 16, a, b);
+		}
+		double mul44_ulp = bench_max_ulp((const float*)bench_out, bench_ref, BENCH_ACCURACY_COUNT, 16);
+
+		k.mat34_mul_batch(bench_out34, bench_a34, bench_b34, 0, BENCH_ACCURACY_COUNT);
+		for (U32 i = 0; i < BENCH_ACCURACY_COUNT; i++) {
+			double a[16], b[16], r[16];
+			ref_load(a, bench_a34[i].data, 3);
+			ref_load(b, bench_b34[i].data, 3);
+			ref_mul(r, a, b);
+			memcpy(bench_ref + i * 12, r, sizeof(double) * 12);
+		}
+		double mul34_ulp = bench_max_ulp((const float*)bench_out34, bench_ref, BENCH_ACCURACY_COUNT, 12);
+
+		k.mat34_from_trs_batch(bench_out34, bench_trs, BENCH_ACCURACY_COUNT);
+		for (U32 i = 0; i < BENCH_ACCURACY_COUNT; i++) {
+			double r[16];
+			ref_trs(r, bench_trs[i]);
+			memcpy(bench_ref + i * 12, r, sizeof(double) * 12);
+		}
+		double trs_ulp = bench_max_ulp((const float*)bench_out34, bench_ref, BENCH_ACCURACY_COUNT, 12);
+
+		for (U32 s = 0; s < Count(bench_sizes); s++) {
+			U32 size = bench_sizes[s];
+			U32 reps = bench_reps(size);
+			U32 ops = reps * size;
+			U64 ticks;
+
+			BENCH_TIME(ticks, reps, k.transform_aos(bench_points_out, bench_points, size, bench_a[rep_ % BENCH_SINGLE_COUNT], 1.0f));
+			bench_add("transform_points", path, size, ticks, ops, aos_ulp);
+
+			BENCH_TIME(ticks, reps, k.transform_soa(bench_ox, bench_oy, bench_oz, bench_x, bench_y, bench_z, size, bench_a[rep_ % BENCH_SINGLE_COUNT], 1.0f));
+			bench_add("transform_points_soa", path, size, ticks, ops, soa_ulp);
+
+			BENCH_TIME(ticks, reps, k.mat44_mul_batch(bench_out, bench_a, bench_b, 0, size));
+			bench_add("mat44_mul_batch", path, size, ticks, ops, mul44_ulp);
+
+			BENCH_TIME(ticks, reps, k.mat34_mul_batch(bench_out34, bench_a34, bench_b34, 0, size));
+			bench_add("mat34_mul_batch", path, size, ticks, ops, mul34_ulp);
+
+			BENCH_TIME(ticks, reps, k.mat34_from_trs_batch(bench_out34, bench_trs, size));
+			bench_add("mat34_from_trs_batch", path, size, ticks, ops, trs_ulp);
+		}
+	}
+}
+
+// Ray-triangle tests, ns/op is per ray-triangle pair
+void bench_ray_triangle()
+{
+	static Triangle_Packet8 tris[BENCH_SINGLE_COUNT];
+	static Triangle_Packet4 tris4[BENCH_SINGLE_COUNT * 2];
+	static Ray_Packet8 rays[BENCH_SINGLE_COUNT];
+	static Vec3 verts[BENCH_SINGLE_COUNT][3];
+	Ray ray = ray_to_point(vec3(0.0f, 0.0f, -20.0f), vec3(0.0f, 0.0f, 0.0f));
+	U32 ops = bench_iterations * BENCH_SINGLE_COUNT * 8;
+	U32 hits = 0;
+	U64 ticks;
+
+	for (U32 i = 0; i < BENCH_SINGLE_COUNT; i++) {
+		for (U32 lane = 0; lane < 8; lane++) {
+			Vec3 a = bench_points[i*8 + lane];
+			Vec3 b = a + bench_random_vec3() * 10.0f;
+			Vec3 c = a + bench_random_vec3() * 10.0f;
+			triangle_packet_set(&tris[i], lane, a, b, c);
+			triangle_packet_set(&tris4[i*2 + lane/4], lane % 4, a, b, c);
+			ray_packet_set(&rays[i], lane, ray_to_point(bench_random_vec3() * 20.0f, bench_points[i*8 + lane]));
+		}
+		verts[i][0] = bench_points[i];
+		verts[i][1] = bench_points[i] + bench_random_vec3() * 10.0f;
+		verts[i][2] = bench_points[i] + bench_random_vec3() * 10.0f;
+	}
+
+	BENCH_TIME(ticks, bench_iterations, {
+		for (U32 i = 0; i < BENCH_SINGLE_COUNT; i++) {
+			for (U32 lane = 0; lane < 8; lane++)
+				hits += intersect_ray_triangle(ray, bench_points[i*8 + lane], verts[i][1], verts[i][2]).hit;
+		}
+	});
+	bench_add("ray triangle", "scalar", 1, ticks, ops, -1.0);
+
+	BENCH_TIME(ticks, bench_iterations, {
+		for (U32 i = 0; i < BENCH_SINGLE_COUNT * 2; i++)
+			hits += intersect_ray_triangle4(ray, tris4[i]).hit;
+	});
+	bench_add("ray triangle4", "default", 4, ticks, ops, -1.0);
+
+	Cpu_Path active = cpu_path();
+	for (U32 p = 0; p <= (U32)active; p++) {
+		Collision_Kernels k;
+		collision_select_kernels(&k, (Cpu_Path)p);
+		const char *path = cpu_path_names[p];
+		Ray_Triangle_T8 result;
+
+		BENCH_TIME(ticks, bench_iterations, {
+			for (U32 i = 0; i < BENCH_SINGLE_COUNT; i++) {
+				k.ray_triangles8(&result, ray.origin, ray.direction, tris[i]);
+				hits += result.hit;
+			}
+		});
+		bench_add("ray triangle8", path, 8, ticks, ops, -1.0);
+
+		BENCH_TIME(ticks, bench_iterations, {
+			for (U32 i = 0; i < BENCH_SINGLE_COUNT; i++) {
+				k.rays8_triangle(&result, rays[i], verts[i][0], verts[i][1] - verts[i][0], verts[i][2] - verts[i][0]);
+				hits += result.hit;
+			}
+		});
+		bench_add("ray8 triangle", path, 8, ticks, ops, -1.0);
+	}
+
+	// Keeps the results live
+	if (hits == ~0u)
+		printf("\n");
+}
+
+// BVH build and ray queries on a bumpy sphere of about 200k triangles.
+// ns/op is per triangle for the build and per ray for the queries.
+void bench_bvh()
+{
+	const U32 n = 320;
+	U32 vertex_count = (n + 1) * (n + 1);
+	U32 triangle_count = n * n * 2;
+
+	Vec3 *positions = (Vec3*)malloc(sizeof(Vec3) * vertex_count);
+	U32 *indices = (U32*)malloc(sizeof(U32) * 3 * triangle_count);
+
+	for (U32 y = 0; y <= n; y++) {
+		for (U32 x = 0; x <= n; x++) {
+			float theta = (float)y / (float)n * FLT_PI;
+			float phi = (float)x / (float)n * 2.0f * FLT_PI;
+			float radius = 1.0f + 0.05f * sinf(phi * 7.0f) * sinf(theta * 5.0f);
+			positions[y * (n + 1) + x] = vec3(sinf(theta) * cosf(phi), cosf(theta), sinf(theta) * sinf(phi)) * radius;
+		}
+	}
+
+	U32 *index = indices;
+	for (U32 y = 0; y < n; y++) {
+		for (U32 x = 0; x < n; x++) {
+			U32 a = y * (n + 1) + x, b = a + 1, c = a + n + 1, d = c + 1;
+			index[0] = a; index[1] = b; index[2] = c;
+			index[3] = b; index[4] = d; index[5] = c;
+			index += 6;
+		}
+	}
+
+	Bvh bvh;
+	U64 ticks;
+	U64 begin = timer_ticks();
+	bool ok = bvh_build(&bvh, positions, indices, triangle_count);
+	ticks = timer_ticks() - begin;
+	assert(ok);
+	bench_add("bvh build", "default", triangle_count, ticks, triangle_count, -1.0);
+
+	static Ray rays[BENCH_SINGLE_COUNT];
+	for (U32 i = 0; i < BENCH_SINGLE_COUNT; i++)
+		rays[i] = ray_to_point(bench_random_vec3() * 3.0f, bench_random_vec3());
+
+	U32 reps = bench_iterations / 10 + 1;
+	U32 hits = 0;
+
+	BENCH_TIME(ticks, reps, {
+		for (U32 i = 0; i < BENCH_SINGLE_COUNT; i++)
+			hits += bvh_intersect_closest(&bvh, rays[i], FLT_MAX).hit;
+	});
+	bench_add("bvh closest hit", "default", triangle_count, ticks, reps * BENCH_SINGLE_COUNT, -1.0);
+
+	BENCH_TIME(ticks, reps, {
+		for (U32 i = 0; i < BENCH_SINGLE_COUNT; i++)
+			hits += bvh_intersect_any(&bvh, rays[i], FLT_MAX) ? 1 : 0;
+	});
+	bench_add("bvh any hit", "default", triangle_count, ticks, reps * BENCH_SINGLE_COUNT, -1.0);
+
+	Thread_Pool pool;
+	thread_pool_start(&pool, 0);
+
+	// Bake-style batch: short rays leaving points on the surface in random directions
+	const U32 batch_count = 1 << 18;
+	Ray *batch = (Ray*)malloc(sizeof(Ray) * batch_count);
+	Bvh_Hit *batch_hits = (Bvh_Hit*)malloc(sizeof(Bvh_Hit) * batch_count);
+	bool *occluded = (bool*)malloc(sizeof(bool) * batch_count);
+	for (U32 i = 0; i < batch_count; i++) {
+		Vec3 origin = positions[(i * 7919) % vertex_count] * 1.06f;
+		batch[i] = ray_to_point(origin, origin + bench_random_vec3());
+	}
+
+	BENCH_TIME(ticks, 1, {
+		for (U32 i = 0; i < batch_count; i++)
+			batch_hits[i] = bvh_intersect_closest(&bvh, batch[i], 0.5f);
+	});
+	bench_add("bvh closest batch", "single", triangle_count, ticks, batch_count, -1.0);
+
+	BENCH_TIME(ticks, 1, bvh_intersect_closest_batch(&bvh, batch, batch_count, 0.5f, batch_hits, 0));
+	bench_add("bvh closest batch", "serial", triangle_count, ticks, batch_count, -1.0);
+
+	BENCH_TIME(ticks, 1, bvh_intersect_closest_batch(&bvh, batch, batch_count, 0.5f, batch_hits, &pool));
+	bench_add("bvh closest batch", "threads", triangle_count, ticks, batch_count, -1.0);
+
+	BENCH_TIME(ticks, 1, bvh_intersect_any_batch(&bvh, batch, batch_count, 0.5f, occluded, &pool));
+	bench_add("bvh any batch", "threads", triangle_count, ticks, batch_count, -1.0);
+
+	for (U32 i = 0; i < batch_count; i++)
+		hits += batch_hits[i].hit + (occluded[i] ? 1 : 0);
+
+	free(batch);
+	free(batch_hits);
+	free(occluded);
+
+	// Refit to a twisted copy, ns/op is per triangle like the build
+	Vec3 *twisted = (Vec3*)malloc(sizeof(Vec3) * vertex_count);
+	for (U32 i = 0; i < vertex_count; i++) {
+		Vec3 p = positions[i];
+		float angle = p.y * 0.5f;
+		twisted[i] = vec3(p.x * cosf(angle) - p.z * sinf(angle), p.y, p.x * sinf(angle) + p.z * cosf(angle));
+	}
+
+	Bvh_Refit refit;
+	bvh_refit_init(&refit, &bvh, (pool.thread_count + 1) * 4, 0.0f);
+
+	BENCH_TIME(ticks, 1, bvh_refit(&bvh, &refit, rep_ % 2 ? positions : twisted, indices, 0));
+	bench_add("bvh refit", "serial", triangle_count, ticks, triangle_count, -1.0);
+
+	BENCH_TIME(ticks, 1, bvh_refit(&bvh, &refit, rep_ % 2 ? positions : twisted, indices, &pool));
+	bench_add("bvh refit", "threads", triangle_count, ticks, triangle_count, -1.0);
+
+	bvh_refit_free(&refit);
+	thread_pool_stop(&pool);
+
+	if (hits == ~0u)
+		printf("\n");
+
+	bvh_free(&bvh);
+	free(twisted);
+	free(positions);
+	free(indices);
+}
+
+// One ray against every bone capsule of many characters, as in hover
+// highlighting. ns/op is per capsule.
+void bench_capsules()
+{
+	const U32 character_count = 256;
+	const U32 bone_count = 32;
+	const U32 capsule_count = character_count * bone_count;
+	const U32 packet_count = bone_count / 4;
+
+	Capsule *capsules = (Capsule*)malloc(sizeof(Capsule) * capsule_count);
+	Capsule_Packet4 *packets = (Capsule_Packet4*)malloc(sizeof(Capsule_Packet4) * character_count * packet_count);
+	for (U32 i = 0; i < capsule_count; i++) {
+		Vec3 a = bench_random_vec3() * 20.0f;
+		capsules[i] = capsule(a, a + bench_random_vec3() * 0.5f, 0.1f + bench_random() * 0.1f);
+	}
+	for (U32 c = 0; c < character_count; c++)
+		capsule_packets_set(packets + c * packet_count, capsules + c * bone_count, bone_count);
+
+	static Ray rays[BENCH_SINGLE_COUNT];
+	for (U32 i = 0; i < BENCH_SINGLE_COUNT; i++)
+		rays[i] = ray_to_point(bench_random_vec3() * 30.0f, bench_random_vec3() * 20.0f);
+
+	U32 reps = bench_iterations / 100 + 1;
+	U32 hits = 0;
+	U64 ticks;
+
+	BENCH_TIME(ticks, reps, {
+		const Ray& ray = rays[rep_ % BENCH_SINGLE_COUNT];
+		for (U32 i = 0; i < capsule_count; i++)
+			hits += intersect_ray_capsule(ray, capsules[i]) < FLT_MAX ? 1 : 0;
+	});
+	bench_add("ray capsule", "scalar", bone_count, ticks, reps * capsule_count, -1.0);
+
+	BENCH_TIME(ticks, reps, {
+		const Ray& ray = rays[rep_ % BENCH_SINGLE_COUNT];
+		for (U32 c = 0; c < character_count; c++)
+			hits += intersect_ray_capsules(ray, packets + c * packet_count, bone_count, FLT_MAX).hit;
+	});
+	bench_add("ray capsules", "default", bone_count, ticks, reps * capsule_count, -1.0);
+
+	BENCH_TIME(ticks, reps, {
+		U32 overlaps[32];
+		Vec3 center = rays[rep_ % BENCH_SINGLE_COUNT].origin * 0.5f;
+		for (U32 c = 0; c < character_count; c++)
+			hits += overlap_sphere_capsules(overlaps, center, 2.0f, packets + c * packet_count, bone_count);
+	});
+	bench_add("sphere capsules", "default", bone_count, ticks, reps * capsule_count, -1.0);
+
+	if (hits == ~0u)
+		printf("\n");
+
+	free(capsules);
+	free(packets);
+}
+
+// Ray queries against 3000 gizmo-sized boxes, as in editor picking, and
+// moving every box by a small step. ns/op is per query and per move.
+void bench_aabb_tree()
+{
+	const U32 box_count = 3000;
+	Aabb *boxes = (Aabb*)malloc(sizeof(Aabb) * box_count);
+	U32 *proxies = (U32*)malloc(sizeof(U32) * box_count);
+	U32 *users = (U32*)malloc(sizeof(U32) * box_count);
+
+	Aabb_Tree tree;
+	aabb_tree_init(&tree, 0.5f);
+	for (U32 i = 0; i < box_count; i++) {
+		Vec3 center = bench_random_vec3() * 100.0f;
+		boxes[i].min = center - vec3(2.5f, 2.5f, 2.5f);
+		boxes[i].max = center + vec3(2.5f, 2.5f, 2.5f);
+		proxies[i] = aabb_tree_insert(&tree, boxes[i], i);
+	}
+
+	static Ray rays[BENCH_SINGLE_COUNT];
+	for (U32 i = 0; i < BENCH_SINGLE_COUNT; i++)
+		rays[i] = ray_to_point(bench_random_vec3() * 150.0f, bench_random_vec3() * 100.0f);
+
+	U32 reps = bench_iterations / 10 + 1;
+	U32 hits = 0;
+	U64 ticks;
+
+	BENCH_TIME(ticks, reps, {
+		for (U32 i = 0; i < BENCH_SINGLE_COUNT; i++) {
+			Vec3 inv_dir = bvh_inverse_direction(rays[i].direction);
+			for (U32 j = 0; j < box_count; j++)
+				hits += bvh_ray_aabb(boxes[j], rays[i].origin, inv_dir, FLT_MAX) != FLT_MAX ? 1 : 0;
+		}
+	});
+	bench_add("aabb ray query", "brute", box_count, ticks, reps * BENCH_SINGLE_COUNT, -1.0);
+
+	BENCH_TIME(ticks, reps, {
+		for (U32 i = 0; i < BENCH_SINGLE_COUNT; i++)
+			hits += aabb_tree_query_ray(&tree, rays[i], FLT_MAX, users, box_count);
+	});
+	bench_add("aabb ray query", "tree", box_count, ticks, reps * BENCH_SINGLE_COUNT, -1.0);
+
+	BENCH_TIME(ticks, reps, {
+		Vec3 step = bench_random_vec3() * 0.2f;
+		for (U32 i = 0; i < box_count; i++) {
+			boxes[i].min = boxes[i].min + step;
+			boxes[i].max = boxes[i].max + step;
+			hits += aabb_tree_move(&tree, proxies[i], boxes[i]) ? 1 : 0;
+		}
+	});
+	bench_add("aabb tree move", "tree", box_count, ticks, reps * box_count, -1.0);
+
+	if (hits == ~0u)
+		printf("\n");
+
+	aabb_tree_free(&tree);
+	free(boxes);
+	free(proxies);
+	free(users);
+}
+
+// Batch kernels without per-path variants
+void bench_other_batches()
+{
+	for (U32 i = 0; i < BENCH_ACCURACY_COUNT; i++) {
+		double m[16];
+		ref_load(m, bench_a34[i].data, 3);
+		ref_normal_matrix(bench_ref + i * 9, m);
+	}
+	normal_matrix_batch(bench_out33, bench_a34, BENCH_ACCURACY_COUNT);
+	double normal_ulp = bench_max_ulp((const float*)bench_out33, bench_ref, BENCH_ACCURACY_COUNT, 9);
+
+	// World matrices accumulate the error of every ancestor
+	trs_compose_batch(bench_out34, bench_trs, bench_parent, BENCH_ACCURACY_COUNT);
+	static double world[BENCH_ACCURACY_COUNT][16];
+	for (U32 i = 0; i < BENCH_ACCURACY_COUNT; i++) {
+		double local[16];
+		ref_trs(local, bench_trs[i]);
+		if (bench_parent[i] != ~0u)
+			ref_mul(world[i], local, world[bench_parent[i]]);
+		else
+			memcpy(world[i], local, sizeof(local));
+		memcpy(bench_ref + i * 12, world[i], sizeof(double) * 12);
+	}
+	double compose_ulp = bench_max_ulp((const float*)bench_out34, bench_ref, BENCH_ACCURACY_COUNT, 12);
+
+	for (U32 s = 0; s < Count(bench_sizes); s++) {
+		U32 size = bench_sizes[s];
+		U32 reps = bench_reps(size);
+		U32 ops = reps * size;
+		U64 ticks;
+
+		BENCH_TIME(ticks, reps, mat44_transpose_batch(bench_out, bench_a, size));
+		bench_add("mat44_transpose_batch", "default", size, ticks, ops, -1.0);
+
+		BENCH_TIME(ticks, reps, normal_matrix_batch(bench_out33, bench_a34, size));
+		bench_add("normal_matrix_batch", "default", size, ticks, ops, normal_ulp);
+
+		BENCH_TIME(ticks, reps, trs_compose_batch(bench_out34, bench_trs, bench_parent, size));
+		bench_add("trs_compose_batch", "default", size, ticks, ops, compose_ulp);
+
+		BENCH_TIME(ticks, reps, dual_quat_batch(bench_dq, bench_a34, size));
+		bench_add("dual_quat_batch", "default", size, ticks, ops, -1.0);
+	}
+}
+
+bool bench_write_json(const char *path)
+{
+	FILE *f = fopen(path, "w");
+	if (!f)
+		return false;
+
+	fprintf(f, "{\n");
+	fprintf(f, "\t\"cpu_path\": \"%s\",\n", cpu_path_names[cpu_path()]);
+	fprintf(f, "\t\"best_path\": \"%s\",\n", cpu_path_names[cpu_get_info()->best_path]);
+	fprintf(f, "\t\"iterations\": %u,\n", bench_iterations);
+	fprintf(f, "\t\"results\": [\n");
+	for (U32 i = 0; i < bench_result_count; i++) {
+		Bench_Result *r = &bench_results[i];
+		fprintf(f, "\t\t{ \"name\": \"%s\", \"path\": \"%s\", \"size\": %u, \"ns_per_op\": %.4f, \"max_ulp\": ",
+			r->name, r->path, r->size, r->ns_per_op);
+		if (r->max_ulp >= 0.0)
+			fprintf(f, "%.3f }", r->max_ulp);
+		else
+			fprintf(f, "null }");
+		fprintf(f, "%s\n", i + 1 < bench_result_count ? "," : "");
+	}
+	fprintf(f, "\t]\n");
+	fprintf(f, "}\n");
+
+	fclose(f);
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	const char *json_path = 0;
+
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+			bench_iterations = (U32)atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-p") && i + 1 < argc) {
+			Cpu_Path path;
+			if (!cpu_path_from_name(argv[++i], &path)) {
+				fprintf(stderr, "Unknown path '%s'\n", argv[i]);
+				return 1;
+			}
+			cpu_force_path(path);
+		} else if (!strcmp(argv[i], "-j") && i + 1 < argc) {
+			json_path = argv[++i];
+		} else {
+			fprintf(stderr, "Usage: bench [-n iterations] [-p path] [-j results.json]\n");
+			return 1;
+		}
+	}
+	if (bench_iterations == 0)
+		bench_iterations = 1;
+
+	printf("CPU path %s (best %s)\n\n", cpu_path_names[cpu_path()], cpu_path_names[cpu_get_info()->best_path]);
+
+	bench_setup();
+	bench_single_ops();
+	bench_dispatched_kernels();
+	bench_other_batches();
+	bench_ray_triangle();
+	bench_bvh();
+	bench_capsules();
+	bench_aabb_tree();
+
+	if (json_path && !bench_write_json(json_path)) {
+		fprintf(stderr, "Could not write %s\n", json_path);
+		return 1;
+	}
+
+	return 0;
+}
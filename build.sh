@@ -2,5 +2,10 @@
 
 mkdir -p bin
 
-clang++ -msse2 -DHAS_SSE2 -g -I ../assimp/include/ -L ../assimp/lib/ -I ./imgui -lassimp -lglfw3 -framework Cocoa -framework OpenGL -framework IOKit -framework CoreVideo -o bin/test build_editor.cpp
+# `./build.sh bench` builds only the headless benchmarks, works on Linux too
+if [ "$1" != "bench" ]; then
+	clang++ -msse2 -DHAS_SSE2 -g -I ../assimp/include/ -L ../assimp/lib/ -I ./imgui -lassimp -lglfw3 -framework Cocoa -framework OpenGL -framework IOKit -framework CoreVideo -o bin/test build_editor.cpp
+fi
 
+clang++ -O2 -msse2 -DHAS_SSE2 -g -pthread -o bin/bench build_bench.cpp
+clang++ -O2 -mavx -DHAS_SSE2 -DHAS_AVX -g -pthread -o bin/bench_avx build_bench.cpp
@@ -0,0 +1,18 @@
+
+#include "prelude.h"
+#include "intrinsics.h"
+
+#if defined(_WIN32)
+	#define NOMINMAX
+	#include <Windows.h>
+#endif
+
+#include "timer.cpp"
+#include "cpu.cpp"
+#include "math.cpp"
+#include "collision.cpp"
+#include "thread.cpp"
+#include "bvh.cpp"
+#include "aabb_tree.cpp"
+#include "bench_main.cpp"
+
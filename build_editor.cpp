@@ -21,8 +21,12 @@
 #include "imgui/imgui_draw.cpp"
 #include "imgui_impl_glfw.cpp"
 #include "temp_allocator.cpp"
+#include "cpu.cpp"
 #include "math.cpp"
 #include "collision.cpp"
+#include "thread.cpp"
+#include "bvh.cpp"
+#include "aabb_tree.cpp"
 #include "debug_draw.cpp"
 #include "editor_widget.cpp"
 #include "model.cpp"
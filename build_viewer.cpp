@@ -14,9 +14,12 @@
 	#error "Unknown platform"
 #endif
 
+#include "cpu.cpp"
 #include "math.cpp"
 #include "collision.cpp"
 #include "streams.cpp"
+#include "thread.cpp"
 #include "opengl.cpp"
+#include "mesh_loader.cpp"
 #include "viewer_main.cpp"
 
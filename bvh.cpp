@@ -0,0 +1,1270 @@
+
+// Bounding volume hierarchy over triangles, built with binned SAH. Leaves store
+// their triangles as packets for intersect_ray_triangle4.
+
+#define BVH_BIN_COUNT 16
+#define BVH_MAX_LEAF_SIZE 8
+#define BVH_STACK_SIZE 64
+
+// Relative cost of visiting a node compared to testing a packet of triangles
+#define BVH_TRAVERSAL_COST 1.0f
+
+// Leaves are tested a packet of 4 at a time
+#define BVH_PACKETS(count) (((count) + 3) / 4)
+
+struct Bvh_Node
+{
+	Aabb bounds;
+
+	// Inner nodes: index of the first child, the second one follows it.
+	// Leaves: index of the first triangle packet.
+	U32 first;
+
+	// Number of triangles in a leaf, 0 for inner nodes
+	U32 count;
+};
+
+struct Bvh
+{
+	Bvh_Node *nodes;
+	U32 node_count;
+
+	Triangle_Packet4 *packets;
+	U32 *packet_triangles;
+	U32 packet_count;
+
+	U32 triangle_count;
+};
+
+// Triangle `triangle` was hit at `t` with barycentrics `u` and `v`
+struct Bvh_Hit
+{
+	float t;
+	float u, v;
+	U32 triangle;
+	int hit;
+};
+
+struct Bvh_Builder
+{
+	Bvh *bvh;
+	Aabb *tri_bounds;
+	Vec3 *centroids;
+	U32 *tris;
+};
+
+struct Bvh_Bin
+{
+	Aabb bounds;
+	U32 count;
+};
+
+static Aabb bvh_range_bounds(const Bvh_Builder *b, U32 first, U32 count, Aabb *centroid_bounds)
+{
+	Aabb bounds = aabb_empty();
+	Aabb cbounds = aabb_empty();
+	for (U32 i = first; i < first + count; i++) {
+		U32 tri = b->tris[i];
+		bounds = aabb_union(bounds, b->tri_bounds[tri]);
+		cbounds = aabb_add(cbounds, b->centroids[tri]);
+	}
+	*centroid_bounds = cbounds;
+	return bounds;
+}
+
+static U32 bvh_bin_index(float c, float min, float scale)
+{
+	U32 bin = (U32)((c - min) * scale);
+	return bin < BVH_BIN_COUNT ? bin : BVH_BIN_COUNT - 1;
+}
+
+static void bvh_build_recursive(Bvh_Builder *b, U32 node_index, U32 first, U32 count, U32 depth)
+{
+	Bvh_Node *node = &b->bvh->nodes[node_index];
+
+	Aabb centroid_bounds;
+	node->bounds = bvh_range_bounds(b, first, count, &centroid_bounds);
+	node->first = first;
+	node->count = count;
+
+	if (count <= 2 || depth + 1 >= BVH_STACK_SIZE)
+		return;
+
+	// Find the cheapest split over all axes
+	float best_cost = FLT_MAX;
+	int best_axis = -1;
+	U32 best_split = 0;
+
+	const float *cmin = &centroid_bounds.min.x;
+	const float *cmax = &centroid_bounds.max.x;
+
+	for (int axis = 0; axis < 3; axis++) {
+		float extent = cmax[axis] - cmin[axis];
+		if (extent <= 0.0f)
+			continue;
+
+		Bvh_Bin bins[BVH_BIN_COUNT];
+		for (U32 i = 0; i < BVH_BIN_COUNT; i++) {
+			bins[i].bounds = aabb_empty();
+			bins[i].count = 0;
+		}
+
+		float scale = (float)BVH_BIN_COUNT / extent;
+		for (U32 i = first; i < first + count; i++) {
+			U32 tri = b->tris[i];
+			U32 bin = bvh_bin_index((&b->centroids[tri].x)[axis], cmin[axis], scale);
+			bins[bin].bounds = aabb_union(bins[bin].bounds, b->tri_bounds[tri]);
+			bins[bin].count++;
+		}
+
+		// Sweep from the right to get the cost of the right side of each split
+		float right_cost[BVH_BIN_COUNT];
+		Aabb right = aabb_empty();
+		U32 right_count = 0;
+		for (U32 i = BVH_BIN_COUNT - 1; i > 0; i--) {
+			right = aabb_union(right, bins[i].bounds);
+			right_count += bins[i].count;
+			right_cost[i] = aabb_surface_area(right) * (float)BVH_PACKETS(right_count);
+		}
+
+		Aabb left = aabb_empty();
+		U32 left_count = 0;
+		for (U32 i = 0; i < BVH_BIN_COUNT - 1; i++) {
+			left = aabb_union(left, bins[i].bounds);
+			left_count += bins[i].count;
+			if (left_count == 0 || left_count == count)
+				continue;
+
+			float cost = aabb_surface_area(left) * (float)BVH_PACKETS(left_count) + right_cost[i + 1];
+			if (cost < best_cost) {
+				best_cost = cost;
+				best_axis = axis;
+				best_split = i + 1;
+			}
+		}
+	}
+
+	float area = aabb_surface_area(node->bounds);
+	float leaf_cost = (float)BVH_PACKETS(count);
+	float split_cost = area > 0.0f ? BVH_TRAVERSAL_COST + best_cost / area : FLT_MAX;
+
+	if (count <= BVH_MAX_LEAF_SIZE && (best_axis < 0 || split_cost >= leaf_cost))
+		return;
+
+	U32 mid;
+	if (best_axis >= 0) {
+		float scale = (float)BVH_BIN_COUNT / (cmax[best_axis] - cmin[best_axis]);
+		U32 *lo = b->tris + first;
+		U32 *hi = b->tris + first + count;
+		while (lo < hi) {
+			U32 bin = bvh_bin_index((&b->centroids[*lo].x)[best_axis], cmin[best_axis], scale);
+			if (bin < best_split) {
+				lo++;
+			} else {
+				U32 tmp = *lo;
+				*lo = *--hi;
+				*hi = tmp;
+			}
+		}
+		mid = (U32)(lo - b->tris);
+	} else {
+		// All centroids are the same, split the range in half
+		mid = first + count / 2;
+	}
+
+	U32 child = b->bvh->node_count;
+	b->bvh->node_count += 2;
+
+	node->first = child;
+	node->count = 0;
+
+	bvh_build_recursive(b, child + 0, first, mid - first, depth + 1);
+	bvh_build_recursive(b, child + 1, mid, first + count - mid, depth + 1);
+}
+
+bool bvh_build(Bvh *bvh, const Vec3 *positions, const U32 *indices, U32 triangle_count)
+{
+	memset(bvh, 0, sizeof(Bvh));
+	bvh->triangle_count = triangle_count;
+	if (triangle_count == 0)
+		return true;
+
+	Bvh_Builder b;
+	b.bvh = bvh;
+	b.tri_bounds = (Aabb*)malloc(sizeof(Aabb) * triangle_count);
+	b.centroids = (Vec3*)malloc(sizeof(Vec3) * triangle_count);
+	b.tris = (U32*)malloc(sizeof(U32) * triangle_count);
+	bvh->nodes = (Bvh_Node*)malloc(sizeof(Bvh_Node) * (triangle_count * 2 - 1));
+
+	if (!b.tri_bounds || !b.centroids || !b.tris || !bvh->nodes) {
+		free(b.tri_bounds);
+		free(b.centroids);
+		free(b.tris);
+		free(bvh->nodes);
+		bvh->nodes = 0;
+		return false;
+	}
+
+	for (U32 i = 0; i < triangle_count; i++) {
+		const U32 *tri = &indices[i * 3];
+		Aabb bounds = aabb_empty();
+		bounds = aabb_add(bounds, positions[tri[0]]);
+		bounds = aabb_add(bounds, positions[tri[1]]);
+		bounds = aabb_add(bounds, positions[tri[2]]);
+		b.tri_bounds[i] = bounds;
+		b.centroids[i] = aabb_center(bounds);
+		b.tris[i] = i;
+	}
+
+	bvh->node_count = 1;
+	bvh_build_recursive(&b, 0, 0, triangle_count, 0);
+
+	// Pack the triangles of each leaf, padding lanes stay degenerate
+	U32 packet_count = 0;
+	for (U32 i = 0; i < bvh->node_count; i++) {
+		if (bvh->nodes[i].count)
+			packet_count += BVH_PACKETS(bvh->nodes[i].count);
+	}
+
+	bvh->packet_count = packet_count;
+	bvh->packets = (Triangle_Packet4*)calloc(packet_count, sizeof(Triangle_Packet4));
+	bvh->packet_triangles = (U32*)malloc(sizeof(U32) * 4 * packet_count);
+
+	bool ok = bvh->packets && bvh->packet_triangles;
+	if (ok) {
+		U32 packet = 0;
+		for (U32 i = 0; i < bvh->node_count; i++) {
+			Bvh_Node *node = &bvh->nodes[i];
+			if (!node->count)
+				continue;
+
+			U32 first_tri = node->first;
+			node->first = packet;
+
+			for (U32 j = 0; j < BVH_PACKETS(node->count) * 4; j++) {
+				U32 *slot = &bvh->packet_triangles[packet * 4 + j];
+				if (j >= node->count) {
+					*slot = ~0u;
+					continue;
+				}
+
+				U32 tri = b.tris[first_tri + j];
+				const U32 *idx = &indices[tri * 3];
+				triangle_packet_set(&bvh->packets[packet + j / 4], j % 4,
+						positions[idx[0]], positions[idx[1]], positions[idx[2]]);
+				*slot = tri;
+			}
+			packet += BVH_PACKETS(node->count);
+		}
+	}
+
+	free(b.tri_bounds);
+	free(b.centroids);
+	free(b.tris);
+
+	if (!ok) {
+		free(bvh->nodes);
+		free(bvh->packets);
+		free(bvh->packet_triangles);
+		memset(bvh, 0, sizeof(Bvh));
+		return false;
+	}
+
+	return true;
+}
+
+void bvh_free(Bvh *bvh)
+{
+	free(bvh->nodes);
+	free(bvh->packets);
+	free(bvh->packet_triangles);
+	memset(bvh, 0, sizeof(Bvh));
+}
+
+// Entry distance of the ray to the bounds, FLT_MAX if it misses before `t_max`
+static float bvh_ray_aabb(const Aabb& b, const Vec3& origin, const Vec3& inv_dir, float t_max)
+{
+	float tx1 = (b.min.x - origin.x) * inv_dir.x;
+	float tx2 = (b.max.x - origin.x) * inv_dir.x;
+	float ty1 = (b.min.y - origin.y) * inv_dir.y;
+	float ty2 = (b.max.y - origin.y) * inv_dir.y;
+	float tz1 = (b.min.z - origin.z) * inv_dir.z;
+	float tz2 = (b.max.z - origin.z) * inv_dir.z;
+
+	float tmin = MMAX(MMAX(MMIN(tx1, tx2), MMIN(ty1, ty2)), MMAX(MMIN(tz1, tz2), 0.0f));
+	float tmax = MMIN(MMIN(MMAX(tx1, tx2), MMAX(ty1, ty2)), MMIN(MMAX(tz1, tz2), t_max));
+
+	return tmin <= tmax ? tmin : FLT_MAX;
+}
+
+static Vec3 bvh_inverse_direction(const Vec3& dir)
+{
+	// Zero components become infinities, which the slab test handles
+	return vec3(1.0f / dir.x, 1.0f / dir.y, 1.0f / dir.z);
+}
+
+// Closest hit with t <= t_max. `t` is in units of the ray direction.
+Bvh_Hit bvh_intersect_closest(const Bvh *bvh, const Ray& ray, float t_max)
+{
+	Bvh_Hit ret;
+	ret.t = t_max;
+	ret.u = 0.0f;
+	ret.v = 0.0f;
+	ret.triangle = ~0u;
+	ret.hit = 0;
+
+	if (!bvh->node_count)
+		return ret;
+
+	Vec3 inv_dir = bvh_inverse_direction(ray.direction);
+	if (bvh_ray_aabb(bvh->nodes[0].bounds, ray.origin, inv_dir, t_max) == FLT_MAX)
+		return ret;
+
+	U32 stack[BVH_STACK_SIZE];
+	U32 stack_size = 0;
+	U32 node_index = 0;
+
+	for (;;) {
+		const Bvh_Node *node = &bvh->nodes[node_index];
+
+		if (node->count) {
+			U32 packet_end = node->first + BVH_PACKETS(node->count);
+			for (U32 p = node->first; p < packet_end; p++) {
+				Ray_Triangle_T4 r = intersect_ray_triangle4(ray, bvh->packets[p]);
+				for (U32 mask = r.hit; mask; mask &= mask - 1) {
+					U32 lane = 0;
+					while (!(mask & (1 << lane))) lane++;
+					if (r.t[lane] <= ret.t) {
+						ret.t = r.t[lane];
+						ret.u = r.u[lane];
+						ret.v = r.v[lane];
+						ret.triangle = bvh->packet_triangles[p * 4 + lane];
+						ret.hit = 1;
+					}
+				}
+			}
+		} else {
+			// Visit the nearer child first, the farther one may get culled
+			// by a closer hit before it's popped
+			U32 near_index = node->first;
+			U32 far_index = node->first + 1;
+			float near_t = bvh_ray_aabb(bvh->nodes[near_index].bounds, ray.origin, inv_dir, ret.t);
+			float far_t = bvh_ray_aabb(bvh->nodes[far_index].bounds, ray.origin, inv_dir, ret.t);
+			if (far_t < near_t) {
+				float tt = near_t; near_t = far_t; far_t = tt;
+				U32 ti = near_index; near_index = far_index; far_index = ti;
+			}
+
+			if (near_t != FLT_MAX) {
+				if (far_t != FLT_MAX) {
+					assert(stack_size < BVH_STACK_SIZE);
+					stack[stack_size++] = far_index;
+				}
+				node_index = near_index;
+				continue;
+			}
+		}
+
+		// Pop the next node that can still contain a closer hit
+		bool found = false;
+		while (stack_size > 0) {
+			node_index = stack[--stack_size];
+			if (bvh_ray_aabb(bvh->nodes[node_index].bounds, ray.origin, inv_dir, ret.t) != FLT_MAX) {
+				found = true;
+				break;
+			}
+		}
+		if (!found)
+			break;
+	}
+
+	return ret;
+}
+
+// Any hit with t <= t_max, for occlusion queries
+bool bvh_intersect_any(const Bvh *bvh, const Ray& ray, float t_max)
+{
+	if (!bvh->node_count)
+		return false;
+
+	Vec3 inv_dir = bvh_inverse_direction(ray.direction);
+
+	U32 stack[BVH_STACK_SIZE];
+	U32 stack_size = 0;
+	stack[stack_size++] = 0;
+
+	while (stack_size > 0) {
+		const Bvh_Node *node = &bvh->nodes[stack[--stack_size]];
+		if (bvh_ray_aabb(node->bounds, ray.origin, inv_dir, t_max) == FLT_MAX)
+			continue;
+
+		if (node->count) {
+			U32 packet_end = node->first + BVH_PACKETS(node->count);
+			for (U32 p = node->first; p < packet_end; p++) {
+				Ray_Triangle_T4 r = intersect_ray_triangle4(ray, bvh->packets[p]);
+				for (U32 lane = 0; lane < 4; lane++) {
+					if ((r.hit & (1 << lane)) && r.t[lane] <= t_max)
+						return true;
+				}
+			}
+		} else {
+			assert(stack_size + 2 <= BVH_STACK_SIZE);
+			stack[stack_size++] = node->first + 1;
+			stack[stack_size++] = node->first;
+		}
+	}
+
+	return false;
+}
+
+struct Bvh_Sweep_Hit
+{
+	float t;
+	Vec3 point;
+	Vec3 normal;
+	U32 triangle;
+	int hit;
+};
+
+// Sweeps a capsule (or a sphere if `sphere`, using only `a`) by `motion * t`.
+// Nodes are tested with the ray from the shape's center against the bounds
+// grown by the shape's half extents.
+static Bvh_Sweep_Hit bvh_sweep(const Bvh *bvh, const Capsule& c, bool sphere, const Vec3& motion, float t_max)
+{
+	Bvh_Sweep_Hit ret;
+	ret.t = t_max;
+	ret.point = vec3(0.0f, 0.0f, 0.0f);
+	ret.normal = vec3(0.0f, 0.0f, 0.0f);
+	ret.triangle = ~0u;
+	ret.hit = 0;
+
+	if (!bvh->node_count)
+		return ret;
+
+	Vec3 axis = sphere ? vec3(0.0f, 0.0f, 0.0f) : c.b - c.a;
+	Vec3 center = c.a + axis * 0.5f;
+	Vec3 extent = vec3(fabsf(axis.x), fabsf(axis.y), fabsf(axis.z)) * 0.5f + vec3(c.radius, c.radius, c.radius);
+	Vec3 inv_dir = bvh_inverse_direction(motion);
+
+	U32 hit_packet = 0, hit_lane = 0;
+
+	U32 stack[BVH_STACK_SIZE];
+	U32 stack_size = 0;
+	stack[stack_size++] = 0;
+
+	while (stack_size > 0) {
+		const Bvh_Node *node = &bvh->nodes[stack[--stack_size]];
+		Aabb bounds;
+		bounds.min = node->bounds.min - extent;
+		bounds.max = node->bounds.max + extent;
+		if (bvh_ray_aabb(bounds, center, inv_dir, ret.t) == FLT_MAX)
+			continue;
+
+		if (node->count) {
+			U32 packet_end = node->first + BVH_PACKETS(node->count);
+			for (U32 p = node->first; p < packet_end; p++) {
+				U32 lanes = 0;
+				for (U32 lane = 0; lane < 4; lane++) {
+					if (bvh->packet_triangles[p * 4 + lane] != ~0u)
+						lanes |= 1 << lane;
+				}
+
+				Sweep_T4 r = sphere
+					? sweep_sphere_triangle4(c.a, c.radius, motion, bvh->packets[p], lanes)
+					: sweep_capsule_triangle4(c, motion, bvh->packets[p], lanes);
+				for (U32 lane = 0; lane < 4; lane++) {
+					if ((r.hit & (1 << lane)) && r.t[lane] <= ret.t) {
+						ret.t = r.t[lane];
+						ret.triangle = bvh->packet_triangles[p * 4 + lane];
+						ret.hit = 1;
+						hit_packet = p;
+						hit_lane = lane;
+					}
+				}
+			}
+		} else {
+			// Children by distance along the motion, nearer popped first
+			U32 near_index = node->first, far_index = node->first + 1;
+			Vec3 d = aabb_center(bvh->nodes[far_index].bounds) - aabb_center(bvh->nodes[near_index].bounds);
+			if (dot(d, motion) < 0.0f) {
+				near_index = far_index;
+				far_index = node->first;
+			}
+
+			assert(stack_size + 2 <= BVH_STACK_SIZE);
+			stack[stack_size++] = far_index;
+			stack[stack_size++] = near_index;
+		}
+	}
+
+	if (!ret.hit)
+		return ret;
+
+	// Contact from the closest points at the time of impact
+	const Triangle_Packet4 *tris = &bvh->packets[hit_packet];
+	Vec3 v0 = packet_get_row(tris->v0[0], 4, hit_lane, 0);
+	Vec3 v1 = v0 + packet_get_row(tris->v0[0], 4, hit_lane, 1);
+	Vec3 v2 = v0 + packet_get_row(tris->v0[0], 4, hit_lane, 2);
+	Vec3 a = c.a + motion * ret.t;
+
+	Vec3 on_shape = a;
+	if (sphere)
+		ret.point = closest_point_on_triangle(a, v0, v1, v2);
+	else
+		closest_points_segment_triangle(a, a + axis, v0, v1, v2, &on_shape, &ret.point);
+
+	Vec3 n = on_shape - ret.point;
+	if (length_squared(n) > 0.0f) {
+		ret.normal = normalize(n);
+	} else {
+		// Touching at the center, use the face against the motion
+		n = cross(v1 - v0, v2 - v0);
+		ret.normal = normalize(dot(n, motion) > 0.0f ? -n : n);
+	}
+
+	return ret;
+}
+
+// First contact of a sphere moving by `motion * t` with t <= t_max. `normal`
+// points from the mesh towards the sphere. Spheres already touching the mesh
+// hit at t = 0.
+Bvh_Sweep_Hit bvh_sweep_sphere(const Bvh *bvh, const Vec3& center, float radius, const Vec3& motion, float t_max)
+{
+	return bvh_sweep(bvh, capsule(center, center, radius), true, motion, t_max);
+}
+
+// Same as bvh_sweep_sphere for a capsule
+Bvh_Sweep_Hit bvh_sweep_capsule(const Bvh *bvh, const Capsule& c, const Vec3& motion, float t_max)
+{
+	return bvh_sweep(bvh, c, false, motion, t_max);
+}
+
+// Refitting keeps the topology and recomputes bounds and triangle packets
+// from new vertex positions. The tree is split into subtrees that are refit in
+// parallel, then the few nodes above them are refit in order. Subtrees whose
+// SAH cost grew past `rebuild_threshold` times the cost when they were built
+// are rebuilt into the nodes and packets they already own.
+
+// The descendants of a node and the packets of its leaves are contiguous
+struct Bvh_Subtree
+{
+	U32 root;
+	U32 node_first, node_end;
+	U32 packet_first, packet_end;
+
+	// SAH cost relative to the root area at the last (re)build
+	float cost;
+	bool rebuilt;
+};
+
+struct Bvh_Refit
+{
+	Bvh_Subtree *subtrees;
+	U32 subtree_count;
+
+	// Inner nodes above the subtrees, parents before children
+	U32 *top_nodes;
+	U32 top_count;
+
+	// 0 never rebuilds
+	float rebuild_threshold;
+};
+
+// Sum of node areas weighted by their cost, divide by the root area for SAH
+static float bvh_subtree_cost(const Bvh *bvh, U32 index)
+{
+	const Bvh_Node *node = &bvh->nodes[index];
+	float area = aabb_surface_area(node->bounds);
+	if (node->count)
+		return area * (float)BVH_PACKETS(node->count);
+
+	return area * BVH_TRAVERSAL_COST
+		+ bvh_subtree_cost(bvh, node->first)
+		+ bvh_subtree_cost(bvh, node->first + 1);
+}
+
+static float bvh_relative_cost(const Bvh *bvh, U32 index)
+{
+	float area = aabb_surface_area(bvh->nodes[index].bounds);
+	return area > 0.0f ? bvh_subtree_cost(bvh, index) / area : 0.0f;
+}
+
+static void bvh_subtree_ranges(const Bvh *bvh, U32 index, Bvh_Subtree *st)
+{
+	const Bvh_Node *node = &bvh->nodes[index];
+	if (node->count) {
+		U32 end = node->first + BVH_PACKETS(node->count);
+		if (node->first < st->packet_first) st->packet_first = node->first;
+		if (end > st->packet_end) st->packet_end = end;
+		return;
+	}
+
+	if (node->first < st->node_first) st->node_first = node->first;
+	if (node->first + 2 > st->node_end) st->node_end = node->first + 2;
+	bvh_subtree_ranges(bvh, node->first, st);
+	bvh_subtree_ranges(bvh, node->first + 1, st);
+}
+
+static void bvh_refit_split(const Bvh *bvh, Bvh_Refit *r, U32 index, U32 depth, U32 cut_depth)
+{
+	const Bvh_Node *node = &bvh->nodes[index];
+
+	if (node->count || depth == cut_depth) {
+		Bvh_Subtree *st = &r->subtrees[r->subtree_count++];
+		st->root = index;
+		st->node_first = ~0u;
+		st->node_end = 0;
+		st->packet_first = ~0u;
+		st->packet_end = 0;
+		bvh_subtree_ranges(bvh, index, st);
+		if (st->node_first == ~0u)
+			st->node_first = st->node_end = 0;
+		st->cost = bvh_relative_cost(bvh, index);
+		st->rebuilt = false;
+		return;
+	}
+
+	r->top_nodes[r->top_count++] = index;
+	bvh_refit_split(bvh, r, node->first, depth + 1, cut_depth);
+	bvh_refit_split(bvh, r, node->first + 1, depth + 1, cut_depth);
+}
+
+// Splits the tree into about `subtree_target` subtrees, a few per thread
+// balances the uneven subtree sizes
+bool bvh_refit_init(Bvh_Refit *r, const Bvh *bvh, U32 subtree_target, float rebuild_threshold)
+{
+	memset(r, 0, sizeof(Bvh_Refit));
+	r->rebuild_threshold = rebuild_threshold;
+	if (!bvh->node_count)
+		return true;
+
+	U32 cut_depth = 0;
+	while ((1u << cut_depth) < subtree_target && cut_depth < 16)
+		cut_depth++;
+
+	r->subtrees = (Bvh_Subtree*)malloc(sizeof(Bvh_Subtree) << cut_depth);
+	r->top_nodes = (U32*)malloc(sizeof(U32) << cut_depth);
+	if (!r->subtrees || !r->top_nodes) {
+		free(r->subtrees);
+		free(r->top_nodes);
+		memset(r, 0, sizeof(Bvh_Refit));
+		return false;
+	}
+
+	bvh_refit_split(bvh, r, 0, 0, cut_depth);
+	return true;
+}
+
+void bvh_refit_free(Bvh_Refit *r)
+{
+	free(r->subtrees);
+	free(r->top_nodes);
+	memset(r, 0, sizeof(Bvh_Refit));
+}
+
+static void bvh_refit_leaf(Bvh *bvh, Bvh_Node *node, const Vec3 *positions, const U32 *indices)
+{
+	Aabb bounds = aabb_empty();
+	for (U32 j = 0; j < node->count; j++) {
+		const U32 *idx = &indices[bvh->packet_triangles[node->first * 4 + j] * 3];
+		Vec3 a = positions[idx[0]], b = positions[idx[1]], c = positions[idx[2]];
+		triangle_packet_set(&bvh->packets[node->first + j / 4], j % 4, a, b, c);
+		bounds = aabb_add(aabb_add(aabb_add(bounds, a), b), c);
+	}
+	node->bounds = bounds;
+}
+
+static void bvh_refit_recursive(Bvh *bvh, U32 index, const Vec3 *positions, const U32 *indices)
+{
+	Bvh_Node *node = &bvh->nodes[index];
+	if (node->count) {
+		bvh_refit_leaf(bvh, node, positions, indices);
+		return;
+	}
+
+	bvh_refit_recursive(bvh, node->first, positions, indices);
+	bvh_refit_recursive(bvh, node->first + 1, positions, indices);
+	node->bounds = aabb_union(bvh->nodes[node->first].bounds, bvh->nodes[node->first + 1].bounds);
+}
+
+static void bvh_gather_triangles(const Bvh *bvh, U32 index, U32 *tris, U32 *count)
+{
+	const Bvh_Node *node = &bvh->nodes[index];
+	if (node->count) {
+		for (U32 j = 0; j < node->count; j++)
+			tris[(*count)++] = bvh->packet_triangles[node->first * 4 + j];
+		return;
+	}
+	bvh_gather_triangles(bvh, node->first, tris, count);
+	bvh_gather_triangles(bvh, node->first + 1, tris, count);
+}
+
+// Builds the subtree again from scratch, fails if the result doesn't fit in
+// the nodes and packets the subtree owns
+static bool bvh_rebuild_subtree(Bvh *bvh, Bvh_Subtree *st, const Vec3 *positions, const U32 *indices)
+{
+	U32 max_tris = (st->packet_end - st->packet_first) * 4;
+	U32 *tris = (U32*)malloc(sizeof(U32) * max_tris);
+	U32 *sub_indices = (U32*)malloc(sizeof(U32) * 3 * max_tris);
+	if (!tris || !sub_indices) {
+		free(tris);
+		free(sub_indices);
+		return false;
+	}
+
+	U32 tri_count = 0;
+	bvh_gather_triangles(bvh, st->root, tris, &tri_count);
+	for (U32 i = 0; i < tri_count; i++) {
+		sub_indices[i * 3 + 0] = indices[tris[i] * 3 + 0];
+		sub_indices[i * 3 + 1] = indices[tris[i] * 3 + 1];
+		sub_indices[i * 3 + 2] = indices[tris[i] * 3 + 2];
+	}
+
+	Bvh sub;
+	bool ok = bvh_build(&sub, positions, sub_indices, tri_count)
+		&& sub.node_count - 1 <= st->node_end - st->node_first
+		&& sub.packet_count <= st->packet_end - st->packet_first;
+
+	if (ok) {
+		// Node 0 maps to the subtree root, the rest to the owned range
+		for (U32 k = 0; k < sub.node_count; k++) {
+			Bvh_Node node = sub.nodes[k];
+			if (node.count)
+				node.first += st->packet_first;
+			else
+				node.first = st->node_first + node.first - 1;
+			bvh->nodes[k ? st->node_first + k - 1 : st->root] = node;
+		}
+
+		memcpy(bvh->packets + st->packet_first, sub.packets, sizeof(Triangle_Packet4) * sub.packet_count);
+		for (U32 i = 0; i < sub.packet_count * 4; i++) {
+			U32 tri = sub.packet_triangles[i];
+			bvh->packet_triangles[st->packet_first * 4 + i] = tri != ~0u ? tris[tri] : ~0u;
+		}
+
+		st->cost = bvh_relative_cost(bvh, st->root);
+	}
+
+	bvh_free(&sub);
+	free(tris);
+	free(sub_indices);
+	return ok;
+}
+
+struct Bvh_Refit_Job
+{
+	Bvh *bvh;
+	Bvh_Refit *refit;
+	const Vec3 *positions;
+	const U32 *indices;
+};
+
+static void bvh_refit_task(void *user, U32 task)
+{
+	Bvh_Refit_Job *job = (Bvh_Refit_Job*)user;
+	Bvh_Subtree *st = &job->refit->subtrees[task];
+
+	bvh_refit_recursive(job->bvh, st->root, job->positions, job->indices);
+
+	st->rebuilt = false;
+	float threshold = job->refit->rebuild_threshold;
+	if (threshold > 0.0f && !job->bvh->nodes[st->root].count) {
+		float cost = bvh_relative_cost(job->bvh, st->root);
+		if (cost > st->cost * threshold)
+			st->rebuilt = bvh_rebuild_subtree(job->bvh, st, job->positions, job->indices);
+	}
+}
+
+// Updates the BVH for new positions of the same triangles, returns the number
+// of subtrees that were rebuilt. `pool` may be null.
+U32 bvh_refit(Bvh *bvh, Bvh_Refit *refit, const Vec3 *positions, const U32 *indices, Thread_Pool *pool)
+{
+	Bvh_Refit_Job job;
+	job.bvh = bvh;
+	job.refit = refit;
+	job.positions = positions;
+	job.indices = indices;
+
+	thread_pool_run(pool, bvh_refit_task, &job, refit->subtree_count);
+
+	for (U32 i = refit->top_count; i > 0; i--) {
+		Bvh_Node *node = &bvh->nodes[refit->top_nodes[i - 1]];
+		node->bounds = aabb_union(bvh->nodes[node->first].bounds, bvh->nodes[node->first + 1].bounds);
+	}
+
+	U32 rebuilt = 0;
+	for (U32 i = 0; i < refit->subtree_count; i++)
+		rebuilt += refit->subtrees[i].rebuilt ? 1 : 0;
+	return rebuilt;
+}
+
+// Skinned meshes get a static BVH per bone instead of one that follows the
+// pose. Each triangle belongs to the bone with the most total weight on its
+// vertices and is assumed to move rigidly with it, which is exact for rigid
+// parts and close elsewhere. The BVHs stay in the bind pose, the palette
+// (bind pose to posed world) brings rays into the space of each bone.
+struct Skinned_Bvh
+{
+	Bvh *bones;
+	U32 bone_count;
+
+	// Mesh triangle of each BVH triangle, grouped by bone
+	U32 *triangles;
+	U32 *bone_first;
+
+	// Dominant bone of each mesh triangle
+	U32 *triangle_bone;
+	U32 triangle_count;
+};
+
+bool skinned_bvh_build(Skinned_Bvh *sb, const Vec3 *positions, const U32 *indices, U32 triangle_count,
+		const U8 *bone_indices, const float *bone_weights, U32 bones_per_vertex, U32 bone_count)
+{
+	memset(sb, 0, sizeof(Skinned_Bvh));
+	sb->bone_count = bone_count;
+	sb->triangle_count = triangle_count;
+
+	sb->bones = (Bvh*)calloc(bone_count, sizeof(Bvh));
+	sb->triangles = (U32*)malloc(sizeof(U32) * triangle_count);
+	sb->bone_first = (U32*)calloc(bone_count + 1, sizeof(U32));
+	sb->triangle_bone = (U32*)malloc(sizeof(U32) * triangle_count);
+	U32 *bone_indices_out = (U32*)malloc(sizeof(U32) * 3 * triangle_count);
+
+	bool ok = sb->bones && sb->triangles && sb->bone_first && sb->triangle_bone && bone_indices_out;
+
+	for (U32 i = 0; ok && i < triangle_count; i++) {
+		U32 bones[3 * 16];
+		float weights[3 * 16];
+		U32 count = 0;
+		assert(bones_per_vertex <= 16);
+
+		for (U32 c = 0; c < 3; c++) {
+			U32 base = indices[i * 3 + c] * bones_per_vertex;
+			for (U32 w = 0; w < bones_per_vertex; w++) {
+				U32 bone = bone_indices[base + w];
+				U32 j = 0;
+				while (j < count && bones[j] != bone) j++;
+				if (j == count) {
+					bones[count] = bone;
+					weights[count] = 0.0f;
+					count++;
+				}
+				weights[j] += bone_weights[base + w];
+			}
+		}
+
+		U32 best = 0;
+		for (U32 j = 1; j < count; j++) {
+			if (weights[j] > weights[best])
+				best = j;
+		}
+		best = count ? bones[best] : 0;
+
+		assert(best < bone_count);
+		sb->triangle_bone[i] = best;
+		sb->bone_first[best + 1]++;
+	}
+
+	if (ok) {
+		for (U32 i = 0; i < bone_count; i++)
+			sb->bone_first[i + 1] += sb->bone_first[i];
+
+		// Counting sort by bone, reusing the end offsets as cursors
+		for (U32 i = 0; i < triangle_count; i++) {
+			U32 slot = sb->bone_first[sb->triangle_bone[i]]++;
+			sb->triangles[slot] = i;
+		}
+		for (U32 i = bone_count; i > 0; i--)
+			sb->bone_first[i] = sb->bone_first[i - 1];
+		sb->bone_first[0] = 0;
+
+		for (U32 i = 0; i < triangle_count; i++) {
+			const U32 *tri = &indices[sb->triangles[i] * 3];
+			bone_indices_out[i * 3 + 0] = tri[0];
+			bone_indices_out[i * 3 + 1] = tri[1];
+			bone_indices_out[i * 3 + 2] = tri[2];
+		}
+	}
+
+	for (U32 i = 0; ok && i < bone_count; i++) {
+		U32 first = sb->bone_first[i];
+		U32 count = sb->bone_first[i + 1] - first;
+		ok = bvh_build(&sb->bones[i], positions, bone_indices_out + first * 3, count);
+	}
+
+	free(bone_indices_out);
+
+	if (!ok) {
+		for (U32 i = 0; sb->bones && i < bone_count; i++)
+			bvh_free(&sb->bones[i]);
+		free(sb->bones);
+		free(sb->triangles);
+		free(sb->bone_first);
+		free(sb->triangle_bone);
+		memset(sb, 0, sizeof(Skinned_Bvh));
+		return false;
+	}
+
+	return true;
+}
+
+void skinned_bvh_free(Skinned_Bvh *sb)
+{
+	for (U32 i = 0; i < sb->bone_count; i++)
+		bvh_free(&sb->bones[i]);
+	free(sb->bones);
+	free(sb->triangles);
+	free(sb->bone_first);
+	free(sb->triangle_bone);
+	memset(sb, 0, sizeof(Skinned_Bvh));
+}
+
+// Closest hit against the mesh posed by `palette`, the same bind pose to world
+// matrices the mesh is drawn with. The triangle index refers to the mesh.
+Bvh_Hit skinned_bvh_intersect_closest(const Skinned_Bvh *sb, const Ray& ray, const Mat34 *palette, float t_max)
+{
+	Bvh_Hit ret;
+	ret.t = t_max;
+	ret.u = 0.0f;
+	ret.v = 0.0f;
+	ret.triangle = ~0u;
+	ret.hit = 0;
+
+	struct Candidate
+	{
+		float t;
+		U32 bone;
+		Ray ray;
+	};
+
+	Candidate candidates[256];
+	U32 candidate_count = 0;
+	assert(sb->bone_count <= Count(candidates));
+
+	// Cull bones by their bounds and sort the rest by entry distance
+	for (U32 i = 0; i < sb->bone_count; i++) {
+		const Bvh *bvh = &sb->bones[i];
+		if (!bvh->node_count)
+			continue;
+
+		Mat34 to_bone = inverse(palette[i]);
+		Ray bone_ray = ray_to_dir(ray.origin * to_bone, transform_direction(ray.direction, to_bone));
+
+		float t = bvh_ray_aabb(bvh->nodes[0].bounds, bone_ray.origin, bvh_inverse_direction(bone_ray.direction), t_max);
+		if (t == FLT_MAX)
+			continue;
+
+		U32 slot = candidate_count++;
+		for (; slot > 0 && candidates[slot - 1].t > t; slot--)
+			candidates[slot] = candidates[slot - 1];
+		candidates[slot].t = t;
+		candidates[slot].bone = i;
+		candidates[slot].ray = bone_ray;
+	}
+
+	// Affine transforms keep `t`, so hits compare across bones
+	for (U32 i = 0; i < candidate_count; i++) {
+		const Candidate *c = &candidates[i];
+		if (c->t > ret.t)
+			break;
+
+		Bvh_Hit hit = bvh_intersect_closest(&sb->bones[c->bone], c->ray, ret.t);
+		if (hit.hit) {
+			ret = hit;
+			ret.triangle = sb->triangles[sb->bone_first[c->bone] + hit.triangle];
+		}
+	}
+
+	return ret;
+}
+
+// Batched queries sort rays by direction octant and then by the Morton code of
+// their origin, so neighbouring rays go through mostly the same nodes. Sorted
+// rays are traced as packets of 4 that share node tests, packets are handed
+// to the thread pool in tasks.
+
+#define BVH_BATCH_PACKETS_PER_TASK 64
+
+struct Bvh_Ray_Packet
+{
+	float ox[4], oy[4], oz[4];
+	float ix[4], iy[4], iz[4];
+	float t[4];
+
+	// Lanes that still need traversal
+	U32 active;
+
+	Ray rays[4];
+	U32 ray_index[4];
+};
+
+static U32 bvh_morton_spread(U32 x)
+{
+	// 9 bits to every third bit
+	x &= 0x1FF;
+	x = (x | (x << 16)) & 0x030000FF;
+	x = (x | (x << 8)) & 0x0300F00F;
+	x = (x | (x << 4)) & 0x030C30C3;
+	x = (x | (x << 2)) & 0x09249249;
+	return x;
+}
+
+// Returns the ray indices ordered by octant and origin
+static U32 *bvh_sort_rays(const Ray *rays, U32 count)
+{
+	U32 *keys = (U32*)malloc(sizeof(U32) * count * 2);
+	U32 *order = (U32*)malloc(sizeof(U32) * count * 2);
+	if (!keys || !order) {
+		free(keys);
+		free(order);
+		return 0;
+	}
+
+	Aabb bounds = aabb_empty();
+	for (U32 i = 0; i < count; i++)
+		bounds = aabb_add(bounds, rays[i].origin);
+
+	Vec3 extent = bounds.max - bounds.min;
+	Vec3 scale = vec3(extent.x > 0.0f ? 511.0f / extent.x : 0.0f,
+			extent.y > 0.0f ? 511.0f / extent.y : 0.0f,
+			extent.z > 0.0f ? 511.0f / extent.z : 0.0f);
+
+	for (U32 i = 0; i < count; i++) {
+		const Ray *r = &rays[i];
+		Vec3 q = (r->origin - bounds.min) * scale;
+		U32 octant = (r->direction.x < 0.0f ? 1 : 0) | (r->direction.y < 0.0f ? 2 : 0) | (r->direction.z < 0.0f ? 4 : 0);
+		U32 morton = bvh_morton_spread((U32)q.x) | bvh_morton_spread((U32)q.y) << 1 | bvh_morton_spread((U32)q.z) << 2;
+		keys[i] = octant << 27 | morton;
+		order[i] = i;
+	}
+
+	// LSD radix sort, 8 bits per pass
+	U32 *key_src = keys, *key_dst = keys + count;
+	U32 *src = order, *dst = order + count;
+	for (U32 shift = 0; shift < 32; shift += 8) {
+		U32 offsets[256] = { 0 };
+		for (U32 i = 0; i < count; i++)
+			offsets[(key_src[i] >> shift) & 0xFF]++;
+
+		U32 sum = 0;
+		for (U32 d = 0; d < 256; d++) {
+			U32 c = offsets[d];
+			offsets[d] = sum;
+			sum += c;
+		}
+
+		for (U32 i = 0; i < count; i++) {
+			U32 slot = offsets[(key_src[i] >> shift) & 0xFF]++;
+			key_dst[slot] = key_src[i];
+			dst[slot] = src[i];
+		}
+
+		U32 *tmp = key_src; key_src = key_dst; key_dst = tmp;
+		tmp = src; src = dst; dst = tmp;
+	}
+
+	// Even number of passes, the result is back in the first half
+	free(keys);
+	return order;
+}
+
+static void bvh_packet_setup(Bvh_Ray_Packet *p, const Ray *rays, const U32 *order, U32 count, float t_max)
+{
+	memset(p, 0, sizeof(Bvh_Ray_Packet));
+	for (U32 lane = 0; lane < 4; lane++) {
+		// Empty lanes repeat the first ray but stay inactive
+		U32 index = order[lane < count ? lane : 0];
+		const Ray *r = &rays[index];
+		Vec3 inv_dir = bvh_inverse_direction(r->direction);
+
+		p->ox[lane] = r->origin.x; p->oy[lane] = r->origin.y; p->oz[lane] = r->origin.z;
+		p->ix[lane] = inv_dir.x; p->iy[lane] = inv_dir.y; p->iz[lane] = inv_dir.z;
+		p->t[lane] = t_max;
+		p->rays[lane] = *r;
+		p->ray_index[lane] = index;
+		if (lane < count)
+			p->active |= 1 << lane;
+	}
+}
+
+// Mask of active lanes that enter the bounds before their current t
+static U32 bvh_packet_aabb(const Bvh_Ray_Packet *p, const Aabb& b)
+{
+#ifdef HAS_SSE2
+	__m128 ix = _mm_loadu_ps(p->ix), iy = _mm_loadu_ps(p->iy), iz = _mm_loadu_ps(p->iz);
+	__m128 ox = _mm_loadu_ps(p->ox), oy = _mm_loadu_ps(p->oy), oz = _mm_loadu_ps(p->oz);
+
+	__m128 tx1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(b.min.x), ox), ix);
+	__m128 tx2 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(b.max.x), ox), ix);
+	__m128 ty1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(b.min.y), oy), iy);
+	__m128 ty2 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(b.max.y), oy), iy);
+	__m128 tz1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(b.min.z), oz), iz);
+	__m128 tz2 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(b.max.z), oz), iz);
+
+	__m128 tmin = _mm_max_ps(_mm_max_ps(_mm_min_ps(tx1, tx2), _mm_min_ps(ty1, ty2)), _mm_max_ps(_mm_min_ps(tz1, tz2), _mm_setzero_ps()));
+	__m128 tmax = _mm_min_ps(_mm_min_ps(_mm_max_ps(tx1, tx2), _mm_max_ps(ty1, ty2)), _mm_min_ps(_mm_max_ps(tz1, tz2), _mm_loadu_ps(p->t)));
+
+	return (U32)_mm_movemask_ps(_mm_cmple_ps(tmin, tmax)) & p->active;
+#else
+	U32 mask = 0;
+	for (U32 lane = 0; lane < 4; lane++) {
+		if (!(p->active & (1 << lane)))
+			continue;
+		Vec3 origin = vec3(p->ox[lane], p->oy[lane], p->oz[lane]);
+		Vec3 inv_dir = vec3(p->ix[lane], p->iy[lane], p->iz[lane]);
+		if (bvh_ray_aabb(b, origin, inv_dir, p->t[lane]) != FLT_MAX)
+			mask |= 1 << lane;
+	}
+	return mask;
+#endif
+}
+
+// Traces the packet, `hits` is null for any-hit queries which deactivate lanes
+// on their first hit
+static void bvh_packet_trace(const Bvh *bvh, Bvh_Ray_Packet *p, Bvh_Hit *hits)
+{
+	U32 stack[BVH_STACK_SIZE];
+	U32 stack_size = 0;
+	stack[stack_size++] = 0;
+
+	// Rays in a packet share an octant, so this orders children front to back
+	Vec3 dir = p->rays[0].direction;
+
+	while (stack_size > 0 && p->active) {
+		const Bvh_Node *node = &bvh->nodes[stack[--stack_size]];
+		U32 mask = bvh_packet_aabb(p, node->bounds);
+		if (!mask)
+			continue;
+
+		if (!node->count) {
+			U32 near_index = node->first, far_index = node->first + 1;
+			Vec3 d = aabb_center(bvh->nodes[far_index].bounds) - aabb_center(bvh->nodes[near_index].bounds);
+			if (dot(d, dir) < 0.0f) {
+				near_index = far_index;
+				far_index = node->first;
+			}
+
+			assert(stack_size + 2 <= BVH_STACK_SIZE);
+			stack[stack_size++] = far_index;
+			stack[stack_size++] = near_index;
+			continue;
+		}
+
+		U32 packet_end = node->first + BVH_PACKETS(node->count);
+		for (; mask; mask &= mask - 1) {
+			U32 lane = 0;
+			while (!(mask & (1 << lane))) lane++;
+
+			for (U32 pi = node->first; pi < packet_end; pi++) {
+				Ray_Triangle_T4 r = intersect_ray_triangle4(p->rays[lane], bvh->packets[pi]);
+				for (U32 hit_mask = r.hit; hit_mask; hit_mask &= hit_mask - 1) {
+					U32 tri_lane = 0;
+					while (!(hit_mask & (1 << tri_lane))) tri_lane++;
+					if (r.t[tri_lane] > p->t[lane])
+						continue;
+
+					p->t[lane] = r.t[tri_lane];
+					if (!hits) {
+						p->active &= ~(1 << lane);
+						break;
+					}
+
+					Bvh_Hit *hit = &hits[p->ray_index[lane]];
+					hit->t = r.t[tri_lane];
+					hit->u = r.u[tri_lane];
+					hit->v = r.v[tri_lane];
+					hit->triangle = bvh->packet_triangles[pi * 4 + tri_lane];
+					hit->hit = 1;
+				}
+				if (!(p->active & (1 << lane)))
+					break;
+			}
+		}
+	}
+}
+
+struct Bvh_Batch_Job
+{
+	const Bvh *bvh;
+	const Ray *rays;
+	const U32 *order;
+	U32 count;
+	float t_max;
+
+	Bvh_Hit *hits;
+	bool *occluded;
+};
+
+static void bvh_batch_task(void *user, U32 task)
+{
+	Bvh_Batch_Job *job = (Bvh_Batch_Job*)user;
+	U32 first = task * BVH_BATCH_PACKETS_PER_TASK * 4;
+	U32 end = first + BVH_BATCH_PACKETS_PER_TASK * 4;
+	if (end > job->count)
+		end = job->count;
+
+	for (U32 i = first; i < end; i += 4) {
+		Bvh_Ray_Packet p;
+		U32 count = end - i < 4 ? end - i : 4;
+		bvh_packet_setup(&p, job->rays, job->order + i, count, job->t_max);
+
+		if (job->hits) {
+			for (U32 lane = 0; lane < count; lane++) {
+				Bvh_Hit *hit = &job->hits[p.ray_index[lane]];
+				hit->t = job->t_max;
+				hit->u = 0.0f;
+				hit->v = 0.0f;
+				hit->triangle = ~0u;
+				hit->hit = 0;
+			}
+		}
+
+		if (job->bvh->node_count)
+			bvh_packet_trace(job->bvh, &p, job->hits);
+
+		if (job->occluded) {
+			for (U32 lane = 0; lane < count; lane++)
+				job->occluded[p.ray_index[lane]] = !(p.active & (1 << lane));
+		}
+	}
+}
+
+static bool bvh_batch_run(const Bvh *bvh, const Ray *rays, U32 count, float t_max,
+		Bvh_Hit *hits, bool *occluded, Thread_Pool *pool)
+{
+	if (count == 0)
+		return true;
+
+	U32 *order = bvh_sort_rays(rays, count);
+	if (!order)
+		return false;
+
+	Bvh_Batch_Job job;
+	job.bvh = bvh;
+	job.rays = rays;
+	job.order = order;
+	job.count = count;
+	job.t_max = t_max;
+	job.hits = hits;
+	job.occluded = occluded;
+
+	U32 rays_per_task = BVH_BATCH_PACKETS_PER_TASK * 4;
+	thread_pool_run(pool, bvh_batch_task, &job, (count + rays_per_task - 1) / rays_per_task);
+
+	free(order);
+	return true;
+}
+
+// Closest hit of every ray, hits[i] is for rays[i]. `pool` may be null.
+bool bvh_intersect_closest_batch(const Bvh *bvh, const Ray *rays, U32 count, float t_max,
+		Bvh_Hit *hits, Thread_Pool *pool)
+{
+	return bvh_batch_run(bvh, rays, count, t_max, hits, 0, pool);
+}
+
+// Whether each ray hits anything before t_max
+bool bvh_intersect_any_batch(const Bvh *bvh, const Ray *rays, U32 count, float t_max,
+		bool *occluded, Thread_Pool *pool)
+{
+	return bvh_batch_run(bvh, rays, count, t_max, 0, occluded, pool);
+}
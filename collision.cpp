@@ -47,6 +47,50 @@ Plane plane_from_point_normal(Vec3 point, Vec3 normal)
 	return plane(normal, d);
 }
 
+struct Aabb
+{
+	Vec3 min;
+	Vec3 max;
+};
+
+// Inverted bounds, adding any point makes it valid
+Aabb aabb_empty()
+{
+	Aabb ret;
+	ret.min = vec3(FLT_MAX, FLT_MAX, FLT_MAX);
+	ret.max = vec3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	return ret;
+}
+
+Aabb aabb_add(const Aabb& a, const Vec3& point)
+{
+	Aabb ret;
+	ret.min = vec3_min(a.min, point);
+	ret.max = vec3_max(a.max, point);
+	return ret;
+}
+
+Aabb aabb_union(const Aabb& a, const Aabb& b)
+{
+	Aabb ret;
+	ret.min = vec3_min(a.min, b.min);
+	ret.max = vec3_max(a.max, b.max);
+	return ret;
+}
+
+Vec3 aabb_center(const Aabb& a)
+{
+	return (a.min + a.max) * 0.5f;
+}
+
+float aabb_surface_area(const Aabb& a)
+{
+	Vec3 d = a.max - a.min;
+	if (d.x < 0.0f || d.y < 0.0f || d.z < 0.0f)
+		return 0.0f;
+	return 2.0f * (d.x*d.y + d.y*d.z + d.z*d.x);
+}
+
 struct Line_T1
 {
 	float t;
@@ -158,3 +202,1000 @@ Line_Sphere_T intersect_line_sphere(const Ray& ray, const Vec3& center, float ra
 	return intersect_line_sphere(ray.origin, ray.direction, center, radius);
 }
 
+
+// Ray-triangle intersection, Möller-Trumbore. Triangles are two sided and only
+// hits with t >= 0 count. `u` and `v` are the barycentric weights of the second
+// and third vertex, misses return t = FLT_MAX.
+struct Ray_Triangle_T
+{
+	float t;
+	float u, v;
+	int hit;
+};
+
+static int ray_triangle_edges(const Vec3& pos, const Vec3& dir, const Vec3& v0, const Vec3& e1, const Vec3& e2,
+		float *t, float *u, float *v)
+{
+	*t = FLT_MAX;
+	*u = 0.0f;
+	*v = 0.0f;
+
+	// Exactly parallel only, a tiny determinant still gives finite barycentrics
+	// that are rejected below. Keeps the scalar and SIMD paths in agreement.
+	Vec3 p = cross(dir, e2);
+	float det = dot(e1, p);
+	if (det == 0.0f)
+		return 0;
+
+	float inv_det = 1.0f / det;
+	Vec3 tv = pos - v0;
+	float bu = dot(tv, p) * inv_det;
+	Vec3 q = cross(tv, e1);
+	float bv = dot(dir, q) * inv_det;
+	float bt = dot(e2, q) * inv_det;
+
+	if (!(bu >= 0.0f && bv >= 0.0f && bu + bv <= 1.0f && bt >= 0.0f))
+		return 0;
+
+	*t = bt;
+	*u = bu;
+	*v = bv;
+	return 1;
+}
+
+Ray_Triangle_T intersect_ray_triangle(const Vec3& pos, const Vec3& dir, const Vec3& a, const Vec3& b, const Vec3& c)
+{
+	Ray_Triangle_T ret;
+	ret.hit = ray_triangle_edges(pos, dir, a, b - a, c - a, &ret.t, &ret.u, &ret.v);
+	return ret;
+}
+
+Ray_Triangle_T intersect_ray_triangle(const Ray& ray, const Vec3& a, const Vec3& b, const Vec3& c)
+{
+	return intersect_ray_triangle(ray.origin, ray.direction, a, b, c);
+}
+
+// Packets store components in lanes. The triangle rows are v0, e1 = b - a and
+// e2 = c - a; zeroed lanes are degenerate and never hit.
+struct Triangle_Packet4
+{
+	float v0[3][4];
+	float e1[3][4];
+	float e2[3][4];
+};
+
+struct Triangle_Packet8
+{
+	float v0[3][8];
+	float e1[3][8];
+	float e2[3][8];
+};
+
+struct Ray_Packet4
+{
+	float origin[3][4];
+	float direction[3][4];
+};
+
+struct Ray_Packet8
+{
+	float origin[3][8];
+	float direction[3][8];
+};
+
+// `hit` has bit N set when lane N hit
+struct Ray_Triangle_T4
+{
+	float t[4];
+	float u[4];
+	float v[4];
+	U32 hit;
+};
+
+struct Ray_Triangle_T8
+{
+	float t[8];
+	float u[8];
+	float v[8];
+	U32 hit;
+};
+
+static void packet_set_rows(float *rows, U32 width, U32 lane, const Vec3 *vecs, U32 count)
+{
+	for (U32 i = 0; i < count; i++) {
+		rows[(i*3 + 0) * width + lane] = vecs[i].x;
+		rows[(i*3 + 1) * width + lane] = vecs[i].y;
+		rows[(i*3 + 2) * width + lane] = vecs[i].z;
+	}
+}
+
+static Vec3 packet_get_row(const float *rows, U32 width, U32 lane, U32 index)
+{
+	return vec3(rows[(index*3 + 0) * width + lane],
+			rows[(index*3 + 1) * width + lane],
+			rows[(index*3 + 2) * width + lane]);
+}
+
+void triangle_packet_set(Triangle_Packet4 *p, U32 lane, const Vec3& a, const Vec3& b, const Vec3& c)
+{
+	assert(lane < 4);
+	Vec3 rows[3] = { a, b - a, c - a };
+	packet_set_rows(p->v0[0], 4, lane, rows, 3);
+}
+
+void triangle_packet_set(Triangle_Packet8 *p, U32 lane, const Vec3& a, const Vec3& b, const Vec3& c)
+{
+	assert(lane < 8);
+	Vec3 rows[3] = { a, b - a, c - a };
+	packet_set_rows(p->v0[0], 8, lane, rows, 3);
+}
+
+void ray_packet_set(Ray_Packet4 *p, U32 lane, const Ray& ray)
+{
+	assert(lane < 4);
+	Vec3 rows[2] = { ray.origin, ray.direction };
+	packet_set_rows(p->origin[0], 4, lane, rows, 2);
+}
+
+void ray_packet_set(Ray_Packet8 *p, U32 lane, const Ray& ray)
+{
+	assert(lane < 8);
+	Vec3 rows[2] = { ray.origin, ray.direction };
+	packet_set_rows(p->origin[0], 8, lane, rows, 2);
+}
+
+// Kernels process `count` lanes starting from `lane` of a packet `width` wide,
+// the results are written starting from t[0], u[0] and v[0].
+
+static U32 ray_triangles_scalar(const Vec3& pos, const Vec3& dir, const float *tris, U32 width, U32 lane, U32 count,
+		float *t, float *u, float *v)
+{
+	U32 hit = 0;
+	for (U32 i = 0; i < count; i++) {
+		Vec3 v0 = packet_get_row(tris, width, lane + i, 0);
+		Vec3 e1 = packet_get_row(tris, width, lane + i, 1);
+		Vec3 e2 = packet_get_row(tris, width, lane + i, 2);
+		if (ray_triangle_edges(pos, dir, v0, e1, e2, &t[i], &u[i], &v[i]))
+			hit |= 1 << i;
+	}
+	return hit;
+}
+
+static U32 rays_triangle_scalar(const float *rays, U32 width, U32 lane, U32 count,
+		const Vec3& v0, const Vec3& e1, const Vec3& e2, float *t, float *u, float *v)
+{
+	U32 hit = 0;
+	for (U32 i = 0; i < count; i++) {
+		Vec3 pos = packet_get_row(rays, width, lane + i, 0);
+		Vec3 dir = packet_get_row(rays, width, lane + i, 1);
+		if (ray_triangle_edges(pos, dir, v0, e1, e2, &t[i], &u[i], &v[i]))
+			hit |= 1 << i;
+	}
+	return hit;
+}
+
+#ifdef HAS_SSE2
+
+// The SIMD kernels read rays as 6 rows (origin, direction) and triangles as 9
+// rows (v0, e1, e2). A row is `width` floats apart, width 0 broadcasts a single
+// value per row instead.
+static inline __m128 ray_triangle_load_sse2(const float *rows, U32 width, U32 row)
+{
+	return width ? _mm_loadu_ps(rows + row * width) : _mm_set1_ps(rows[row]);
+}
+
+static U32 ray_triangle_sse2(const float *rays, U32 ray_width, const float *tris, U32 tri_width,
+		float *t, float *u, float *v)
+{
+	__m128 zero = _mm_setzero_ps();
+	__m128 one = _mm_set1_ps(1.0f);
+
+	__m128 dx = ray_triangle_load_sse2(rays, ray_width, 3);
+	__m128 dy = ray_triangle_load_sse2(rays, ray_width, 4);
+	__m128 dz = ray_triangle_load_sse2(rays, ray_width, 5);
+	__m128 e1x = ray_triangle_load_sse2(tris, tri_width, 3);
+	__m128 e1y = ray_triangle_load_sse2(tris, tri_width, 4);
+	__m128 e1z = ray_triangle_load_sse2(tris, tri_width, 5);
+	__m128 e2x = ray_triangle_load_sse2(tris, tri_width, 6);
+	__m128 e2y = ray_triangle_load_sse2(tris, tri_width, 7);
+	__m128 e2z = ray_triangle_load_sse2(tris, tri_width, 8);
+
+	// p = cross(dir, e2)
+	__m128 sx = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+	__m128 sy = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+	__m128 sz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+	__m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, sx), _mm_mul_ps(e1y, sy)), _mm_mul_ps(e1z, sz));
+	__m128 inv_det = _mm_div_ps(one, det);
+
+	__m128 tx = _mm_sub_ps(ray_triangle_load_sse2(rays, ray_width, 0), ray_triangle_load_sse2(tris, tri_width, 0));
+	__m128 ty = _mm_sub_ps(ray_triangle_load_sse2(rays, ray_width, 1), ray_triangle_load_sse2(tris, tri_width, 1));
+	__m128 tz = _mm_sub_ps(ray_triangle_load_sse2(rays, ray_width, 2), ray_triangle_load_sse2(tris, tri_width, 2));
+	__m128 bu = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, sx), _mm_mul_ps(ty, sy)), _mm_mul_ps(tz, sz)), inv_det);
+
+	// q = cross(tv, e1)
+	__m128 qx = _mm_sub_ps(_mm_mul_ps(ty, e1z), _mm_mul_ps(tz, e1y));
+	__m128 qy = _mm_sub_ps(_mm_mul_ps(tz, e1x), _mm_mul_ps(tx, e1z));
+	__m128 qz = _mm_sub_ps(_mm_mul_ps(tx, e1y), _mm_mul_ps(ty, e1x));
+	__m128 bv = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), inv_det);
+	__m128 bt = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), inv_det);
+
+	// Ordered compares, so lanes with NaN from a zero determinant fail too
+	__m128 mask = _mm_cmpneq_ps(det, zero);
+	mask = _mm_and_ps(mask, _mm_cmpge_ps(bu, zero));
+	mask = _mm_and_ps(mask, _mm_cmpge_ps(bv, zero));
+	mask = _mm_and_ps(mask, _mm_cmple_ps(_mm_add_ps(bu, bv), one));
+	mask = _mm_and_ps(mask, _mm_cmpge_ps(bt, zero));
+
+	_mm_storeu_ps(t, _mm_or_ps(_mm_and_ps(mask, bt), _mm_andnot_ps(mask, _mm_set1_ps(FLT_MAX))));
+	_mm_storeu_ps(u, _mm_and_ps(mask, bu));
+	_mm_storeu_ps(v, _mm_and_ps(mask, bv));
+	return (U32)_mm_movemask_ps(mask);
+}
+
+static U32 ray_triangles_sse2(const Vec3& pos, const Vec3& dir, const float *tris, U32 width, U32 lane,
+		float *t, float *u, float *v)
+{
+	float ray[6] = { pos.x, pos.y, pos.z, dir.x, dir.y, dir.z };
+	return ray_triangle_sse2(ray, 0, tris + lane, width, t, u, v);
+}
+
+static U32 rays_triangle_sse2(const float *rays, U32 width, U32 lane,
+		const Vec3& v0, const Vec3& e1, const Vec3& e2, float *t, float *u, float *v)
+{
+	float tri[9] = { v0.x, v0.y, v0.z, e1.x, e1.y, e1.z, e2.x, e2.y, e2.z };
+	return ray_triangle_sse2(rays + lane, width, tri, 0, t, u, v);
+}
+
+#endif
+
+// 8-wide kernels, the fallbacks run the packet as halves
+static void ray_triangles8_scalar(Ray_Triangle_T8 *ret, const Vec3& pos, const Vec3& dir, const Triangle_Packet8& tris)
+{
+	ret->hit = ray_triangles_scalar(pos, dir, tris.v0[0], 8, 0, 8, ret->t, ret->u, ret->v);
+}
+
+static void rays8_triangle_scalar(Ray_Triangle_T8 *ret, const Ray_Packet8& rays, const Vec3& v0, const Vec3& e1, const Vec3& e2)
+{
+	ret->hit = rays_triangle_scalar(rays.origin[0], 8, 0, 8, v0, e1, e2, ret->t, ret->u, ret->v);
+}
+
+#ifdef HAS_SSE2
+
+static void ray_triangles8_sse2(Ray_Triangle_T8 *ret, const Vec3& pos, const Vec3& dir, const Triangle_Packet8& tris)
+{
+	U32 lo = ray_triangles_sse2(pos, dir, tris.v0[0], 8, 0, ret->t, ret->u, ret->v);
+	U32 hi = ray_triangles_sse2(pos, dir, tris.v0[0], 8, 4, ret->t + 4, ret->u + 4, ret->v + 4);
+	ret->hit = lo | hi << 4;
+}
+
+static void rays8_triangle_sse2(Ray_Triangle_T8 *ret, const Ray_Packet8& rays, const Vec3& v0, const Vec3& e1, const Vec3& e2)
+{
+	U32 lo = rays_triangle_sse2(rays.origin[0], 8, 0, v0, e1, e2, ret->t, ret->u, ret->v);
+	U32 hi = rays_triangle_sse2(rays.origin[0], 8, 4, v0, e1, e2, ret->t + 4, ret->u + 4, ret->v + 4);
+	ret->hit = lo | hi << 4;
+}
+
+#endif
+
+#ifdef HAS_DISPATCH_AVX
+
+CPU_TARGET("avx") static inline __m256 ray_triangle_load_avx(const float *rows, U32 width, U32 row)
+{
+	return width ? _mm256_loadu_ps(rows + row * width) : _mm256_broadcast_ss(rows + row);
+}
+
+CPU_TARGET("avx") static U32 ray_triangle_avx(const float *rays, U32 ray_width, const float *tris, U32 tri_width,
+		float *t, float *u, float *v)
+{
+	__m256 zero = _mm256_setzero_ps();
+	__m256 one = _mm256_set1_ps(1.0f);
+
+	__m256 dx = ray_triangle_load_avx(rays, ray_width, 3);
+	__m256 dy = ray_triangle_load_avx(rays, ray_width, 4);
+	__m256 dz = ray_triangle_load_avx(rays, ray_width, 5);
+	__m256 e1x = ray_triangle_load_avx(tris, tri_width, 3);
+	__m256 e1y = ray_triangle_load_avx(tris, tri_width, 4);
+	__m256 e1z = ray_triangle_load_avx(tris, tri_width, 5);
+	__m256 e2x = ray_triangle_load_avx(tris, tri_width, 6);
+	__m256 e2y = ray_triangle_load_avx(tris, tri_width, 7);
+	__m256 e2z = ray_triangle_load_avx(tris, tri_width, 8);
+
+	__m256 sx = _mm256_sub_ps(_mm256_mul_ps(dy, e2z), _mm256_mul_ps(dz, e2y));
+	__m256 sy = _mm256_sub_ps(_mm256_mul_ps(dz, e2x), _mm256_mul_ps(dx, e2z));
+	__m256 sz = _mm256_sub_ps(_mm256_mul_ps(dx, e2y), _mm256_mul_ps(dy, e2x));
+	__m256 det = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1x, sx), _mm256_mul_ps(e1y, sy)), _mm256_mul_ps(e1z, sz));
+	__m256 inv_det = _mm256_div_ps(one, det);
+
+	__m256 tx = _mm256_sub_ps(ray_triangle_load_avx(rays, ray_width, 0), ray_triangle_load_avx(tris, tri_width, 0));
+	__m256 ty = _mm256_sub_ps(ray_triangle_load_avx(rays, ray_width, 1), ray_triangle_load_avx(tris, tri_width, 1));
+	__m256 tz = _mm256_sub_ps(ray_triangle_load_avx(rays, ray_width, 2), ray_triangle_load_avx(tris, tri_width, 2));
+	__m256 bu = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(tx, sx), _mm256_mul_ps(ty, sy)), _mm256_mul_ps(tz, sz)), inv_det);
+
+	__m256 qx = _mm256_sub_ps(_mm256_mul_ps(ty, e1z), _mm256_mul_ps(tz, e1y));
+	__m256 qy = _mm256_sub_ps(_mm256_mul_ps(tz, e1x), _mm256_mul_ps(tx, e1z));
+	__m256 qz = _mm256_sub_ps(_mm256_mul_ps(tx, e1y), _mm256_mul_ps(ty, e1x));
+	__m256 bv = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, qx), _mm256_mul_ps(dy, qy)), _mm256_mul_ps(dz, qz)), inv_det);
+	__m256 bt = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2x, qx), _mm256_mul_ps(e2y, qy)), _mm256_mul_ps(e2z, qz)), inv_det);
+
+	__m256 mask = _mm256_cmp_ps(det, zero, _CMP_NEQ_OQ);
+	mask = _mm256_and_ps(mask, _mm256_cmp_ps(bu, zero, _CMP_GE_OQ));
+	mask = _mm256_and_ps(mask, _mm256_cmp_ps(bv, zero, _CMP_GE_OQ));
+	mask = _mm256_and_ps(mask, _mm256_cmp_ps(_mm256_add_ps(bu, bv), one, _CMP_LE_OQ));
+	mask = _mm256_and_ps(mask, _mm256_cmp_ps(bt, zero, _CMP_GE_OQ));
+
+	_mm256_storeu_ps(t, _mm256_blendv_ps(_mm256_set1_ps(FLT_MAX), bt, mask));
+	_mm256_storeu_ps(u, _mm256_and_ps(mask, bu));
+	_mm256_storeu_ps(v, _mm256_and_ps(mask, bv));
+	return (U32)_mm256_movemask_ps(mask);
+}
+
+CPU_TARGET("avx") static void ray_triangles8_avx(Ray_Triangle_T8 *ret, const Vec3& pos, const Vec3& dir, const Triangle_Packet8& tris)
+{
+	float ray[6] = { pos.x, pos.y, pos.z, dir.x, dir.y, dir.z };
+	ret->hit = ray_triangle_avx(ray, 0, tris.v0[0], 8, ret->t, ret->u, ret->v);
+}
+
+CPU_TARGET("avx") static void rays8_triangle_avx(Ray_Triangle_T8 *ret, const Ray_Packet8& rays, const Vec3& v0, const Vec3& e1, const Vec3& e2)
+{
+	float tri[9] = { v0.x, v0.y, v0.z, e1.x, e1.y, e1.z, e2.x, e2.y, e2.z };
+	ret->hit = ray_triangle_avx(rays.origin[0], 8, tri, 0, ret->t, ret->u, ret->v);
+}
+
+#endif
+
+struct Collision_Kernels
+{
+	Cpu_Path path;
+
+	void (*ray_triangles8)(Ray_Triangle_T8 *ret, const Vec3& pos, const Vec3& dir, const Triangle_Packet8& tris);
+	void (*rays8_triangle)(Ray_Triangle_T8 *ret, const Ray_Packet8& rays, const Vec3& v0, const Vec3& e1, const Vec3& e2);
+};
+
+void collision_select_kernels(Collision_Kernels *k, Cpu_Path path)
+{
+	k->path = path;
+	k->ray_triangles8 = ray_triangles8_scalar;
+	k->rays8_triangle = rays8_triangle_scalar;
+
+#ifdef HAS_SSE2
+	if (path >= Cpu_Path_SSE2) {
+		k->ray_triangles8 = ray_triangles8_sse2;
+		k->rays8_triangle = rays8_triangle_sse2;
+	}
+#endif
+#ifdef HAS_DISPATCH_AVX
+	if (path >= Cpu_Path_AVX) {
+		k->ray_triangles8 = ray_triangles8_avx;
+		k->rays8_triangle = rays8_triangle_avx;
+	}
+#endif
+}
+
+static Collision_Kernels collision_kernel_table = { Cpu_Path_Count };
+
+const Collision_Kernels *collision_kernels()
+{
+	Cpu_Path path = cpu_path();
+	if (collision_kernel_table.path != path)
+		collision_select_kernels(&collision_kernel_table, path);
+	return &collision_kernel_table;
+}
+
+// One ray against four triangles
+Ray_Triangle_T4 intersect_ray_triangle4(const Ray& ray, const Triangle_Packet4& tris)
+{
+	Ray_Triangle_T4 ret;
+#ifdef HAS_SSE2
+	ret.hit = ray_triangles_sse2(ray.origin, ray.direction, tris.v0[0], 4, 0, ret.t, ret.u, ret.v);
+#else
+	ret.hit = ray_triangles_scalar(ray.origin, ray.direction, tris.v0[0], 4, 0, 4, ret.t, ret.u, ret.v);
+#endif
+	return ret;
+}
+
+// One ray against eight triangles
+Ray_Triangle_T8 intersect_ray_triangle8(const Ray& ray, const Triangle_Packet8& tris)
+{
+	Ray_Triangle_T8 ret;
+	collision_kernels()->ray_triangles8(&ret, ray.origin, ray.direction, tris);
+	return ret;
+}
+
+// Four rays against one triangle
+Ray_Triangle_T4 intersect_ray4_triangle(const Ray_Packet4& rays, const Vec3& a, const Vec3& b, const Vec3& c)
+{
+	Ray_Triangle_T4 ret;
+#ifdef HAS_SSE2
+	ret.hit = rays_triangle_sse2(rays.origin[0], 4, 0, a, b - a, c - a, ret.t, ret.u, ret.v);
+#else
+	ret.hit = rays_triangle_scalar(rays.origin[0], 4, 0, 4, a, b - a, c - a, ret.t, ret.u, ret.v);
+#endif
+	return ret;
+}
+
+// Eight rays against one triangle
+Ray_Triangle_T8 intersect_ray8_triangle(const Ray_Packet8& rays, const Vec3& a, const Vec3& b, const Vec3& c)
+{
+	Ray_Triangle_T8 ret;
+	collision_kernels()->rays8_triangle(&ret, rays, a, b - a, c - a);
+	return ret;
+}
+
+struct Capsule
+{
+	Vec3 a, b;
+	float radius;
+};
+
+Capsule capsule(const Vec3& a, const Vec3& b, float radius)
+{
+	Capsule ret;
+	ret.a = a;
+	ret.b = b;
+	ret.radius = radius;
+	return ret;
+}
+
+// Radius scales with the largest axis of the transform
+Capsule capsule_transform(const Capsule& c, const Mat34& m)
+{
+	float scale_sq = length_squared(transform_direction(vec3(1.0f, 0.0f, 0.0f), m));
+	float sy = length_squared(transform_direction(vec3(0.0f, 1.0f, 0.0f), m));
+	float sz = length_squared(transform_direction(vec3(0.0f, 0.0f, 1.0f), m));
+	if (sy > scale_sq) scale_sq = sy;
+	if (sz > scale_sq) scale_sq = sz;
+
+	return capsule(c.a * m, c.b * m, c.radius * sqrtf(scale_sq));
+}
+
+// Capsules are the cylinder and both end spheres, so the entry is the closest
+// entry of the three. Rays starting inside hit at t = 0, capsules with zero
+// radius are never hit. Returns FLT_MAX on a miss.
+static float ray_capsule_scalar(const Vec3& pos, const Vec3& dir, const Vec3& a, const Vec3& axis, float radius)
+{
+	if (!(radius > 0.0f))
+		return FLT_MAX;
+
+	float r2 = radius * radius;
+	Vec3 oa = pos - a;
+	float aa = dot(axis, axis);
+	float ad = dot(axis, dir);
+	float ao = dot(axis, oa);
+	float dd = dot(dir, dir);
+	float od = dot(oa, dir);
+	float oo = dot(oa, oa);
+
+	float s = aa > 0.0f ? ao / aa : 0.0f;
+	s = s < 0.0f ? 0.0f : s > 1.0f ? 1.0f : s;
+	if (length_squared(oa - axis * s) <= r2)
+		return 0.0f;
+
+	float t = FLT_MAX;
+
+	// Cylinder, only hits between the end caps count
+	float qa = aa*dd - ad*ad;
+	float qb = aa*od - ao*ad;
+	float qc = aa*oo - ao*ao - r2*aa;
+	float h = qb*qb - qa*qc;
+	if (qa > 0.0f && h >= 0.0f) {
+		float tc = (-qb - sqrtf(h)) / qa;
+		float y = ao + tc*ad;
+		if (tc >= 0.0f && y >= 0.0f && y <= aa)
+			t = tc;
+	}
+
+	// End spheres
+	for (U32 i = 0; i < 2; i++) {
+		Vec3 oc = i ? oa - axis : oa;
+		float sb = dot(oc, dir);
+		float sh = sb*sb - dd*(dot(oc, oc) - r2);
+		if (dd > 0.0f && sh >= 0.0f) {
+			float ts = (-sb - sqrtf(sh)) / dd;
+			if (ts >= 0.0f && ts < t)
+				t = ts;
+		}
+	}
+
+	return t;
+}
+
+static float capsule_distance_squared_scalar(const Vec3& p, const Vec3& a, const Vec3& axis)
+{
+	float aa = dot(axis, axis);
+	float s = aa > 0.0f ? dot(p - a, axis) / aa : 0.0f;
+	s = s < 0.0f ? 0.0f : s > 1.0f ? 1.0f : s;
+	return length_squared(p - a - axis * s);
+}
+
+float intersect_ray_capsule(const Ray& ray, const Capsule& c)
+{
+	return ray_capsule_scalar(ray.origin, ray.direction, c.a, c.b - c.a, c.radius);
+}
+
+bool overlap_sphere_capsule(const Vec3& center, float radius, const Capsule& c)
+{
+	float r = radius + c.radius;
+	return capsule_distance_squared_scalar(center, c.a, c.b - c.a) <= r * r;
+}
+
+// Four capsules as rows (a, axis, radius), axis is b - a
+struct Capsule_Packet4
+{
+	float a[3][4];
+	float axis[3][4];
+	float radius[4];
+};
+
+void capsule_packet_set(Capsule_Packet4 *p, U32 lane, const Capsule& c)
+{
+	Vec3 vecs[2] = { c.a, c.b - c.a };
+	packet_set_rows(p->a[0], 4, lane, vecs, 2);
+	p->radius[lane] = c.radius;
+}
+
+// Packs `count` capsules to packets, returns the number of packets written.
+// Lanes past the end are zeroed and never hit.
+U32 capsule_packets_set(Capsule_Packet4 *packets, const Capsule *capsules, U32 count)
+{
+	U32 packet_count = (count + 3) / 4;
+	memset(packets, 0, sizeof(Capsule_Packet4) * packet_count);
+	for (U32 i = 0; i < count; i++)
+		capsule_packet_set(&packets[i / 4], i % 4, capsules[i]);
+	return packet_count;
+}
+
+struct Ray_Capsule_Hit
+{
+	float t;
+	U32 capsule;
+	int hit;
+};
+
+#ifdef HAS_SSE2
+
+static inline __m128 capsule_dot_sse2(__m128 ax, __m128 ay, __m128 az, __m128 bx, __m128 by, __m128 bz)
+{
+	return _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, bx), _mm_mul_ps(ay, by)), _mm_mul_ps(az, bz));
+}
+
+static inline __m128 capsule_clamp01_sse2(__m128 x)
+{
+	return _mm_min_ps(_mm_max_ps(x, _mm_setzero_ps()), _mm_set1_ps(1.0f));
+}
+
+// Same as ray_capsule_scalar for four capsules
+static __m128 ray_capsule_sse2(const Vec3& pos, const Vec3& dir, const Capsule_Packet4& p)
+{
+	__m128 zero = _mm_setzero_ps();
+	__m128 inf = _mm_set1_ps(FLT_MAX);
+
+	__m128 dx = _mm_set1_ps(dir.x), dy = _mm_set1_ps(dir.y), dz = _mm_set1_ps(dir.z);
+	__m128 ox = _mm_sub_ps(_mm_set1_ps(pos.x), _mm_loadu_ps(p.a[0]));
+	__m128 oy = _mm_sub_ps(_mm_set1_ps(pos.y), _mm_loadu_ps(p.a[1]));
+	__m128 oz = _mm_sub_ps(_mm_set1_ps(pos.z), _mm_loadu_ps(p.a[2]));
+	__m128 bx = _mm_loadu_ps(p.axis[0]), by = _mm_loadu_ps(p.axis[1]), bz = _mm_loadu_ps(p.axis[2]);
+	__m128 radius = _mm_loadu_ps(p.radius);
+	__m128 r2 = _mm_mul_ps(radius, radius);
+
+	__m128 aa = capsule_dot_sse2(bx, by, bz, bx, by, bz);
+	__m128 ad = capsule_dot_sse2(bx, by, bz, dx, dy, dz);
+	__m128 ao = capsule_dot_sse2(bx, by, bz, ox, oy, oz);
+	__m128 dd = _mm_set1_ps(dot(dir, dir));
+	__m128 od = capsule_dot_sse2(ox, oy, oz, dx, dy, dz);
+	__m128 oo = capsule_dot_sse2(ox, oy, oz, ox, oy, oz);
+
+	// Inside test against the closest point on the axis
+	__m128 aa_pos = _mm_cmpgt_ps(aa, zero);
+	__m128 s = capsule_clamp01_sse2(_mm_and_ps(_mm_div_ps(ao, _mm_or_ps(aa, _mm_andnot_ps(aa_pos, _mm_set1_ps(1.0f)))), aa_pos));
+	__m128 cx = _mm_sub_ps(ox, _mm_mul_ps(bx, s));
+	__m128 cy = _mm_sub_ps(oy, _mm_mul_ps(by, s));
+	__m128 cz = _mm_sub_ps(oz, _mm_mul_ps(bz, s));
+	__m128 inside = _mm_cmple_ps(capsule_dot_sse2(cx, cy, cz, cx, cy, cz), r2);
+
+	// Cylinder
+	__m128 qa = _mm_sub_ps(_mm_mul_ps(aa, dd), _mm_mul_ps(ad, ad));
+	__m128 qb = _mm_sub_ps(_mm_mul_ps(aa, od), _mm_mul_ps(ao, ad));
+	__m128 qc = _mm_sub_ps(_mm_sub_ps(_mm_mul_ps(aa, oo), _mm_mul_ps(ao, ao)), _mm_mul_ps(r2, aa));
+	__m128 h = _mm_sub_ps(_mm_mul_ps(qb, qb), _mm_mul_ps(qa, qc));
+	__m128 tc = _mm_div_ps(_mm_sub_ps(_mm_sub_ps(zero, qb), _mm_sqrt_ps(_mm_max_ps(h, zero))), qa);
+	__m128 y = _mm_add_ps(ao, _mm_mul_ps(tc, ad));
+	__m128 cyl = _mm_and_ps(_mm_cmpgt_ps(qa, zero), _mm_cmpge_ps(h, zero));
+	cyl = _mm_and_ps(cyl, _mm_and_ps(_mm_cmpge_ps(tc, zero), _mm_and_ps(_mm_cmpge_ps(y, zero), _mm_cmple_ps(y, aa))));
+	__m128 t = _mm_or_ps(_mm_and_ps(cyl, tc), _mm_andnot_ps(cyl, inf));
+
+	// End spheres
+	__m128 dd_pos = _mm_cmpgt_ps(dd, zero);
+	for (U32 i = 0; i < 2; i++) {
+		__m128 sx = i ? _mm_sub_ps(ox, bx) : ox;
+		__m128 sy = i ? _mm_sub_ps(oy, by) : oy;
+		__m128 sz = i ? _mm_sub_ps(oz, bz) : oz;
+		__m128 sb = capsule_dot_sse2(sx, sy, sz, dx, dy, dz);
+		__m128 sc = _mm_sub_ps(capsule_dot_sse2(sx, sy, sz, sx, sy, sz), r2);
+		__m128 sh = _mm_sub_ps(_mm_mul_ps(sb, sb), _mm_mul_ps(dd, sc));
+		__m128 ts = _mm_div_ps(_mm_sub_ps(_mm_sub_ps(zero, sb), _mm_sqrt_ps(_mm_max_ps(sh, zero))), dd);
+		__m128 ok = _mm_and_ps(_mm_and_ps(dd_pos, _mm_cmpge_ps(sh, zero)), _mm_and_ps(_mm_cmpge_ps(ts, zero), _mm_cmplt_ps(ts, t)));
+		t = _mm_or_ps(_mm_and_ps(ok, ts), _mm_andnot_ps(ok, t));
+	}
+
+	t = _mm_or_ps(_mm_andnot_ps(inside, t), _mm_and_ps(inside, zero));
+	return _mm_or_ps(_mm_and_ps(_mm_cmpgt_ps(radius, zero), t), _mm_andnot_ps(_mm_cmpgt_ps(radius, zero), inf));
+}
+
+static __m128 capsule_distance_squared_sse2(const Vec3& pos, const Capsule_Packet4& p)
+{
+	__m128 ox = _mm_sub_ps(_mm_set1_ps(pos.x), _mm_loadu_ps(p.a[0]));
+	__m128 oy = _mm_sub_ps(_mm_set1_ps(pos.y), _mm_loadu_ps(p.a[1]));
+	__m128 oz = _mm_sub_ps(_mm_set1_ps(pos.z), _mm_loadu_ps(p.a[2]));
+	__m128 bx = _mm_loadu_ps(p.axis[0]), by = _mm_loadu_ps(p.axis[1]), bz = _mm_loadu_ps(p.axis[2]);
+
+	__m128 aa = capsule_dot_sse2(bx, by, bz, bx, by, bz);
+	__m128 aa_pos = _mm_cmpgt_ps(aa, _mm_setzero_ps());
+	__m128 ao = capsule_dot_sse2(bx, by, bz, ox, oy, oz);
+	__m128 s = capsule_clamp01_sse2(_mm_and_ps(_mm_div_ps(ao, _mm_or_ps(aa, _mm_andnot_ps(aa_pos, _mm_set1_ps(1.0f)))), aa_pos));
+
+	__m128 cx = _mm_sub_ps(ox, _mm_mul_ps(bx, s));
+	__m128 cy = _mm_sub_ps(oy, _mm_mul_ps(by, s));
+	__m128 cz = _mm_sub_ps(oz, _mm_mul_ps(bz, s));
+	return capsule_dot_sse2(cx, cy, cz, cx, cy, cz);
+}
+
+#endif
+
+// Entry t of the ray for each capsule of the packet, FLT_MAX on a miss
+static void ray_capsules4(float *t, const Vec3& pos, const Vec3& dir, const Capsule_Packet4& p)
+{
+#ifdef HAS_SSE2
+	_mm_storeu_ps(t, ray_capsule_sse2(pos, dir, p));
+#else
+	for (U32 lane = 0; lane < 4; lane++) {
+		t[lane] = ray_capsule_scalar(pos, dir, packet_get_row(p.a[0], 4, lane, 0),
+				packet_get_row(p.a[0], 4, lane, 1), p.radius[lane]);
+	}
+#endif
+}
+
+// Closest capsule hit before t_max from `capsule_count` packed capsules
+Ray_Capsule_Hit intersect_ray_capsules(const Ray& ray, const Capsule_Packet4 *packets, U32 capsule_count, float t_max)
+{
+	Ray_Capsule_Hit ret;
+	ret.t = t_max;
+	ret.capsule = ~0u;
+	ret.hit = 0;
+
+	U32 packet_count = (capsule_count + 3) / 4;
+	for (U32 pi = 0; pi < packet_count; pi++) {
+		float t[4];
+		ray_capsules4(t, ray.origin, ray.direction, packets[pi]);
+		for (U32 lane = 0; lane < 4; lane++) {
+			if (t[lane] < ret.t && pi * 4 + lane < capsule_count) {
+				ret.t = t[lane];
+				ret.capsule = pi * 4 + lane;
+				ret.hit = 1;
+			}
+		}
+	}
+
+	return ret;
+}
+
+// Writes the indices of capsules overlapping the sphere, returns the count
+U32 overlap_sphere_capsules(U32 *overlaps, const Vec3& center, float radius, const Capsule_Packet4 *packets, U32 capsule_count)
+{
+	U32 count = 0;
+	U32 packet_count = (capsule_count + 3) / 4;
+	for (U32 pi = 0; pi < packet_count; pi++) {
+		const Capsule_Packet4 *p = &packets[pi];
+		U32 mask;
+#ifdef HAS_SSE2
+		__m128 r = _mm_add_ps(_mm_set1_ps(radius), _mm_loadu_ps(p->radius));
+		__m128 overlap = _mm_cmple_ps(capsule_distance_squared_sse2(center, *p), _mm_mul_ps(r, r));
+		mask = (U32)_mm_movemask_ps(_mm_and_ps(overlap, _mm_cmpgt_ps(_mm_loadu_ps(p->radius), _mm_setzero_ps())));
+#else
+		mask = 0;
+		for (U32 lane = 0; lane < 4; lane++) {
+			float r = radius + p->radius[lane];
+			float d2 = capsule_distance_squared_scalar(center, packet_get_row(p->a[0], 4, lane, 0), packet_get_row(p->a[0], 4, lane, 1));
+			if (p->radius[lane] > 0.0f && d2 <= r * r)
+				mask |= 1 << lane;
+		}
+#endif
+		for (U32 lane = 0; lane < 4; lane++) {
+			if (mask & (1 << lane) && pi * 4 + lane < capsule_count)
+				overlaps[count++] = pi * 4 + lane;
+		}
+	}
+	return count;
+}
+
+// Real-Time Collision Detection 5.1.5
+Vec3 closest_point_on_triangle(const Vec3& p, const Vec3& a, const Vec3& b, const Vec3& c)
+{
+	Vec3 ab = b - a;
+	Vec3 ac = c - a;
+	Vec3 ap = p - a;
+	float d1 = dot(ab, ap);
+	float d2 = dot(ac, ap);
+	if (d1 <= 0.0f && d2 <= 0.0f)
+		return a;
+
+	Vec3 bp = p - b;
+	float d3 = dot(ab, bp);
+	float d4 = dot(ac, bp);
+	if (d3 >= 0.0f && d4 <= d3)
+		return b;
+
+	float vc = d1*d4 - d3*d2;
+	if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f)
+		return a + ab * (d1 / (d1 - d3));
+
+	Vec3 cp = p - c;
+	float d5 = dot(ab, cp);
+	float d6 = dot(ac, cp);
+	if (d6 >= 0.0f && d5 <= d6)
+		return c;
+
+	float vb = d5*d2 - d1*d6;
+	if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f)
+		return a + ac * (d2 / (d2 - d6));
+
+	float va = d3*d6 - d5*d4;
+	if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f)
+		return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+
+	float denom = 1.0f / (va + vb + vc);
+	return a + ab * (vb * denom) + ac * (vc * denom);
+}
+
+static float collision_clamp01(float x)
+{
+	return x < 0.0f ? 0.0f : x > 1.0f ? 1.0f : x;
+}
+
+// Closest points of segments p1-q1 and p2-q2 with t1 and t2 in [0, 1]
+// Real-Time Collision Detection 5.1.9
+Line_T2 closest_points_on_segments(const Vec3& p1, const Vec3& q1, const Vec3& p2, const Vec3& q2)
+{
+	Vec3 d1 = q1 - p1;
+	Vec3 d2 = q2 - p2;
+	Vec3 r = p1 - p2;
+	float a = dot(d1, d1);
+	float e = dot(d2, d2);
+	float f = dot(d2, r);
+
+	Line_T2 ret;
+	ret.t1 = 0.0f;
+	ret.t2 = 0.0f;
+	ret.parallel = 0;
+
+	if (a <= COLLISION_EPSILON && e <= COLLISION_EPSILON)
+		return ret;
+
+	if (a <= COLLISION_EPSILON) {
+		ret.t2 = collision_clamp01(f / e);
+		return ret;
+	}
+
+	float c = dot(d1, r);
+	if (e <= COLLISION_EPSILON) {
+		ret.t1 = collision_clamp01(-c / a);
+		return ret;
+	}
+
+	float b = dot(d1, d2);
+	float denom = a*e - b*b;
+	if (denom > 0.0f) {
+		ret.t1 = collision_clamp01((b*f - c*e) / denom);
+	} else {
+		ret.parallel = 1;
+	}
+
+	ret.t2 = (b*ret.t1 + f) / e;
+	if (ret.t2 < 0.0f) {
+		ret.t2 = 0.0f;
+		ret.t1 = collision_clamp01(-c / a);
+	} else if (ret.t2 > 1.0f) {
+		ret.t2 = 1.0f;
+		ret.t1 = collision_clamp01((b - c) / a);
+	}
+
+	return ret;
+}
+
+// Closest points of segment p-q and triangle a-b-c, returns the squared distance
+float closest_points_segment_triangle(const Vec3& p, const Vec3& q, const Vec3& a, const Vec3& b, const Vec3& c,
+		Vec3 *on_segment, Vec3 *on_triangle)
+{
+	Ray_Triangle_T rt = intersect_ray_triangle(p, q - p, a, b, c);
+	if (rt.hit && rt.t <= 1.0f) {
+		*on_segment = *on_triangle = p + (q - p) * rt.t;
+		return 0.0f;
+	}
+
+	// Otherwise an end point is closest to the face or the segment to an edge
+	*on_segment = p;
+	*on_triangle = closest_point_on_triangle(p, a, b, c);
+	float best = length_squared(*on_segment - *on_triangle);
+
+	Vec3 tq = closest_point_on_triangle(q, a, b, c);
+	float dq = length_squared(q - tq);
+	if (dq < best) {
+		best = dq;
+		*on_segment = q;
+		*on_triangle = tq;
+	}
+
+	const Vec3 *verts[3] = { &a, &b, &c };
+	for (U32 i = 0; i < 3; i++) {
+		const Vec3& e0 = *verts[i];
+		const Vec3& e1 = *verts[(i + 1) % 3];
+		Line_T2 ts = closest_points_on_segments(p, q, e0, e1);
+		Vec3 s = p + (q - p) * ts.t1;
+		Vec3 t = e0 + (e1 - e0) * ts.t2;
+		float d = length_squared(s - t);
+		if (d < best) {
+			best = d;
+			*on_segment = s;
+			*on_triangle = t;
+		}
+	}
+
+	return best;
+}
+
+// Sweeps move a shape by `motion * t`, `t` is the first time of contact
+struct Sweep_T4
+{
+	float t[4];
+	U32 hit;
+};
+
+static void sweep_merge(Sweep_T4 *ret, const float *t, U32 mask)
+{
+	for (U32 lane = 0; lane < 4; lane++) {
+		if ((mask & (1 << lane)) && t[lane] < ret->t[lane]) {
+			ret->t[lane] = t[lane];
+			ret->hit |= 1 << lane;
+		}
+	}
+}
+
+// Sphere against the triangles of `lanes`. The sphere touches a triangle when
+// its center enters the triangle grown by the radius: the face moved out on
+// both sides, or a capsule around an edge. Spheres starting in contact hit at
+// t = 0.
+Sweep_T4 sweep_sphere_triangle4(const Vec3& center, float radius, const Vec3& motion, const Triangle_Packet4& tris, U32 lanes)
+{
+	Sweep_T4 ret;
+	ret.hit = 0;
+	for (U32 lane = 0; lane < 4; lane++)
+		ret.t[lane] = FLT_MAX;
+
+	Triangle_Packet4 faces[2];
+	Capsule_Packet4 edges[3];
+	memset(faces, 0, sizeof(faces));
+	memset(edges, 0, sizeof(edges));
+	U32 face_lanes = 0;
+
+	for (U32 lane = 0; lane < 4; lane++) {
+		if (!(lanes & (1 << lane)))
+			continue;
+
+		Vec3 v0 = packet_get_row(tris.v0[0], 4, lane, 0);
+		Vec3 e1 = packet_get_row(tris.v0[0], 4, lane, 1);
+		Vec3 e2 = packet_get_row(tris.v0[0], 4, lane, 2);
+		Vec3 v1 = v0 + e1, v2 = v0 + e2;
+
+		capsule_packet_set(&edges[0], lane, capsule(v0, v1, radius));
+		capsule_packet_set(&edges[1], lane, capsule(v1, v2, radius));
+		capsule_packet_set(&edges[2], lane, capsule(v2, v0, radius));
+
+		Vec3 n = cross(e1, e2);
+		float n_len_sq = length_squared(n);
+		if (n_len_sq <= 0.0f)
+			continue;
+		n = n * (1.0f / sqrtf(n_len_sq));
+
+		// Inside the slab over the face, barycentrics of the projected center
+		float s = dot(center - v0, n);
+		if (fabsf(s) <= radius) {
+			Vec3 q = center - n * s - v0;
+			float d00 = dot(e1, e1), d01 = dot(e1, e2), d11 = dot(e2, e2);
+			float d20 = dot(q, e1), d21 = dot(q, e2);
+			float v = (d11*d20 - d01*d21) / n_len_sq;
+			float w = (d00*d21 - d01*d20) / n_len_sq;
+			if (v >= 0.0f && w >= 0.0f && v + w <= 1.0f) {
+				ret.t[lane] = 0.0f;
+				ret.hit |= 1 << lane;
+			}
+		}
+
+		Vec3 offset = n * radius;
+		triangle_packet_set(&faces[0], lane, v0 + offset, v1 + offset, v2 + offset);
+		triangle_packet_set(&faces[1], lane, v0 - offset, v1 - offset, v2 - offset);
+		face_lanes |= 1 << lane;
+	}
+
+	Ray ray = ray_to_dir(center, motion);
+	for (U32 i = 0; i < 2; i++) {
+		Ray_Triangle_T4 r = intersect_ray_triangle4(ray, faces[i]);
+		sweep_merge(&ret, r.t, r.hit & face_lanes);
+	}
+
+	for (U32 i = 0; i < 3; i++) {
+		float t[4];
+		ray_capsules4(t, center, motion, edges[i]);
+		sweep_merge(&ret, t, lanes);
+	}
+
+	return ret;
+}
+
+// Capsule against the triangles of `lanes`. On top of both end spheres the
+// capsule can first touch a triangle vertex with its side, or a triangle edge
+// with its axis. The latter is the ray against the parallelogram swept by the
+// edge along the axis, moved out by the radius.
+Sweep_T4 sweep_capsule_triangle4(const Capsule& c, const Vec3& motion, const Triangle_Packet4& tris, U32 lanes)
+{
+	Sweep_T4 ret = sweep_sphere_triangle4(c.a, c.radius, motion, tris, lanes);
+
+	Vec3 axis = c.b - c.a;
+	if (length_squared(axis) <= 0.0f)
+		return ret;
+
+	Sweep_T4 end = sweep_sphere_triangle4(c.b, c.radius, motion, tris, lanes);
+	sweep_merge(&ret, end.t, end.hit);
+
+	// Vertices moving by -motion against the capsule are the ray from `a`
+	// against capsules from each vertex along -axis
+	Capsule_Packet4 vertices[3];
+	Triangle_Packet4 sides[3][4];
+	memset(vertices, 0, sizeof(vertices));
+	memset(sides, 0, sizeof(sides));
+	U32 side_lanes[3] = { 0 };
+
+	for (U32 lane = 0; lane < 4; lane++) {
+		if (!(lanes & (1 << lane)))
+			continue;
+
+		Vec3 v0 = packet_get_row(tris.v0[0], 4, lane, 0);
+		Vec3 verts[3] = { v0, v0 + packet_get_row(tris.v0[0], 4, lane, 1), v0 + packet_get_row(tris.v0[0], 4, lane, 2) };
+
+		// Overlapping at the start, this also covers the axis piercing the face
+		Vec3 on_segment, on_triangle;
+		if (closest_points_segment_triangle(c.a, c.b, verts[0], verts[1], verts[2], &on_segment, &on_triangle) <= c.radius * c.radius) {
+			ret.t[lane] = 0.0f;
+			ret.hit |= 1 << lane;
+		}
+
+		for (U32 i = 0; i < 3; i++) {
+			capsule_packet_set(&vertices[i], lane, capsule(verts[i], verts[i] - axis, c.radius));
+
+			Vec3 p = verts[i], q = verts[(i + 1) % 3];
+			Vec3 n = cross(q - p, axis);
+			float n_len_sq = length_squared(n);
+			if (n_len_sq <= 0.0f)
+				continue;
+
+			Vec3 offset = n * (c.radius / sqrtf(n_len_sq));
+			triangle_packet_set(&sides[i][0], lane, p + offset, q + offset, p - axis + offset);
+			triangle_packet_set(&sides[i][1], lane, q + offset, q - axis + offset, p - axis + offset);
+			triangle_packet_set(&sides[i][2], lane, p - offset, q - offset, p - axis - offset);
+			triangle_packet_set(&sides[i][3], lane, q - offset, q - axis - offset, p - axis - offset);
+			side_lanes[i] |= 1 << lane;
+		}
+	}
+
+	Ray ray = ray_to_dir(c.a, motion);
+	for (U32 i = 0; i < 3; i++) {
+		float t[4];
+		ray_capsules4(t, c.a, motion, vertices[i]);
+		sweep_merge(&ret, t, lanes);
+
+		for (U32 j = 0; j < 4; j++) {
+			Ray_Triangle_T4 r = intersect_ray_triangle4(ray, sides[i][j]);
+			sweep_merge(&ret, r.t, r.hit & side_lanes[i]);
+		}
+	}
+
+	return ret;
+}
@@ -0,0 +1,185 @@
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#include <cpuid.h>
+#endif
+
+// Kernel paths in order of preference, each one implies the ones before it.
+// AVX2 also requires FMA.
+enum Cpu_Path
+{
+	Cpu_Path_Scalar,
+	Cpu_Path_SSE2,
+	Cpu_Path_SSE41,
+	Cpu_Path_AVX,
+	Cpu_Path_AVX2,
+	Cpu_Path_AVX512,
+	Cpu_Path_Count,
+};
+
+const char *cpu_path_names[] = {
+	"scalar", "sse2", "sse41", "avx", "avx2", "avx512",
+};
+
+struct Cpu_Info
+{
+	bool sse2, sse41, avx, avx2, fma, avx512f;
+
+	// Best path supported by both the CPU and this build
+	Cpu_Path best_path;
+};
+
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+
+#define CPU_HAS_CPUID
+
+static void cpu_cpuid(U32 *regs, U32 leaf, U32 subleaf)
+{
+	int r[4];
+	__cpuidex(r, (int)leaf, (int)subleaf);
+	for (int i = 0; i < 4; i++)
+		regs[i] = (U32)r[i];
+}
+
+static U64 cpu_xgetbv()
+{
+	return _xgetbv(0);
+}
+
+#elif defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+
+#define CPU_HAS_CPUID
+
+static void cpu_cpuid(U32 *regs, U32 leaf, U32 subleaf)
+{
+	unsigned a, b, c, d;
+	__cpuid_count(leaf, subleaf, a, b, c, d);
+	regs[0] = a;
+	regs[1] = b;
+	regs[2] = c;
+	regs[3] = d;
+}
+
+static U64 cpu_xgetbv()
+{
+	U32 lo, hi;
+	__asm__ __volatile__ ("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+	return ((U64)hi << 32) | lo;
+}
+
+#endif
+
+// Highest path this build has kernels for
+Cpu_Path cpu_compiled_path()
+{
+#if defined(HAS_DISPATCH_AVX512)
+	return Cpu_Path_AVX512;
+#elif defined(HAS_DISPATCH_AVX2)
+	return Cpu_Path_AVX2;
+#elif defined(HAS_DISPATCH_AVX)
+	return Cpu_Path_AVX;
+#elif defined(HAS_DISPATCH_SSE41)
+	return Cpu_Path_SSE41;
+#elif defined(HAS_SSE2)
+	return Cpu_Path_SSE2;
+#else
+	return Cpu_Path_Scalar;
+#endif
+}
+
+Cpu_Info cpu_detect()
+{
+	Cpu_Info info = { 0 };
+
+#ifdef CPU_HAS_CPUID
+	U32 regs[4];
+	cpu_cpuid(regs, 0, 0);
+	U32 max_leaf = regs[0];
+
+	if (max_leaf >= 1) {
+		cpu_cpuid(regs, 1, 0);
+		U32 ecx = regs[2], edx = regs[3];
+
+		info.sse2 = (edx & (1 << 26)) != 0;
+		info.sse41 = (ecx & (1 << 19)) != 0;
+
+		// The OS has to save the wider registers on context switches too
+		bool osxsave = (ecx & (1 << 27)) != 0;
+		U64 xcr0 = osxsave ? cpu_xgetbv() : 0;
+		bool os_avx = (xcr0 & 0x6) == 0x6;
+		bool os_avx512 = (xcr0 & 0xE6) == 0xE6;
+
+		info.avx = os_avx && (ecx & (1 << 28)) != 0;
+		info.fma = os_avx && (ecx & (1 << 12)) != 0;
+
+		if (max_leaf >= 7) {
+			cpu_cpuid(regs, 7, 0);
+			U32 ebx = regs[1];
+			info.avx2 = info.avx && (ebx & (1 << 5)) != 0;
+			info.avx512f = os_avx512 && (ebx & (1 << 16)) != 0;
+		}
+	}
+#endif
+
+	Cpu_Path path = Cpu_Path_Scalar;
+	if (info.sse2) path = Cpu_Path_SSE2;
+	if (info.sse2 && info.sse41) path = Cpu_Path_SSE41;
+	if (path == Cpu_Path_SSE41 && info.avx) path = Cpu_Path_AVX;
+	if (path == Cpu_Path_AVX && info.avx2 && info.fma) path = Cpu_Path_AVX2;
+	if (path == Cpu_Path_AVX2 && info.avx512f) path = Cpu_Path_AVX512;
+
+	Cpu_Path compiled = cpu_compiled_path();
+	info.best_path = path < compiled ? path : compiled;
+
+	return info;
+}
+
+bool cpu_path_from_name(const char *name, Cpu_Path *path)
+{
+	for (U32 i = 0; i < Cpu_Path_Count; i++) {
+		if (!strcmp(name, cpu_path_names[i])) {
+			*path = (Cpu_Path)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+static Cpu_Info cpu_info;
+static Cpu_Path cpu_active_path = Cpu_Path_Count;
+
+static void cpu_init()
+{
+	cpu_info = cpu_detect();
+	cpu_active_path = cpu_info.best_path;
+
+	// CPU_PATH=sse2 etc. forces a slower path for testing and benchmarking
+	const char *forced = getenv("CPU_PATH");
+	Cpu_Path path;
+	if (forced && cpu_path_from_name(forced, &path) && path < cpu_active_path)
+		cpu_active_path = path;
+}
+
+const Cpu_Info *cpu_get_info()
+{
+	if (cpu_active_path == Cpu_Path_Count)
+		cpu_init();
+	return &cpu_info;
+}
+
+// Path the dispatched kernels use, detected on first call
+Cpu_Path cpu_path()
+{
+	if (cpu_active_path == Cpu_Path_Count)
+		cpu_init();
+	return cpu_active_path;
+}
+
+// Force a path, clamped to what the CPU and build support. Kernel tables
+// reselect on their next call, so change this before starting worker threads.
+Cpu_Path cpu_force_path(Cpu_Path path)
+{
+	const Cpu_Info *info = cpu_get_info();
+	cpu_active_path = path < info->best_path ? path : info->best_path;
+	return cpu_active_path;
+}
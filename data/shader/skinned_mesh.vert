@@ -1,6 +1,13 @@
 uniform mat4 uViewProjection;
-uniform mat4 uBones[NUM_BONES];
-uniform mat4 uBonesIT[NUM_BONES];
+
+#if DUAL_QUATERNION
+// Real and dual part of each bone interleaved
+uniform vec4 uBoneDQ[NUM_BONES * 2];
+#else
+uniform mat3x4 uBones[NUM_BONES];
+// Normal matrices, uploaded row-major so they are applied as `norm * uBonesIT[i]`
+uniform mat3 uBonesIT[NUM_BONES];
+#endif
 
 attribute vec3 aVertex;
 attribute vec3 aNormal;
@@ -11,45 +18,81 @@ attribute vec4 aBoneWeight;
 
 varying vec3 vNormal;
 
+#if DUAL_QUATERNION
+
+// Accumulate a weighted bone, flipped to the same hemisphere as `pivot`
+void dq_blend(inout vec4 real, inout vec4 dual, float index, float weight, vec4 pivot)
+{
+	int i = int(index) * 2;
+	vec4 r = uBoneDQ[i];
+	float w = dot(r, pivot) < 0.0 ? -weight : weight;
+	real += r * w;
+	dual += uBoneDQ[i + 1] * w;
+}
+
+#endif
+
 void main()
 {
 	vec4 vert = vec4(aVertex, 1.0);
-	vec4 norm = vec4(aNormal, 0.0);
+	vec3 norm = aNormal;
 
-#if NUM_WEIGHTS == 0
-	vec4 pos = vert;
-	vec4 nrm = norm;
+#if DUAL_QUATERNION && NUM_WEIGHTS > 0
+	vec4 pivot = uBoneDQ[int(aBoneIndex.x) * 2];
+	vec4 real = vec4(0.0);
+	vec4 dual = vec4(0.0);
+
+	dq_blend(real, dual, aBoneIndex.x, aBoneWeight.x, pivot);
+#if NUM_WEIGHTS >= 2
+	dq_blend(real, dual, aBoneIndex.y, aBoneWeight.y, pivot);
+#endif
+#if NUM_WEIGHTS >= 3
+	dq_blend(real, dual, aBoneIndex.z, aBoneWeight.z, pivot);
+#endif
+#if NUM_WEIGHTS >= 4
+	dq_blend(real, dual, aBoneIndex.w, aBoneWeight.w, pivot);
+#endif
+
+	float len = length(real);
+	real /= len;
+	dual /= len;
+
+	vec3 pos = aVertex + 2.0 * cross(real.xyz, cross(real.xyz, aVertex) + real.w * aVertex)
+	         + 2.0 * (real.w * dual.xyz - dual.w * real.xyz + cross(real.xyz, dual.xyz));
+	vec3 nrm = norm + 2.0 * cross(real.xyz, cross(real.xyz, norm) + real.w * norm);
+#elif NUM_WEIGHTS == 0
+	vec3 pos = aVertex;
+	vec3 nrm = norm;
 #elif NUM_WEIGHTS == 1
-	vec4 pos = uBones[int(aBoneIndex.x)] * vert;
-	vec4 nrm = uBonesIT[int(aBoneIndex.x)] * norm;
+	vec3 pos = vert * uBones[int(aBoneIndex.x)];
+	vec3 nrm = norm * uBonesIT[int(aBoneIndex.x)];
 #elif NUM_WEIGHTS == 2
-	vec4 pos = uBones[int(aBoneIndex.x)] * vert * aBoneWeight.x
-	         + uBones[int(aBoneIndex.y)] * vert * aBoneWeight.y;
+	vec3 pos = vert * uBones[int(aBoneIndex.x)] * aBoneWeight.x
+	         + vert * uBones[int(aBoneIndex.y)] * aBoneWeight.y;
 	
-	vec4 nrm = uBonesIT[int(aBoneIndex.x)] * norm * aBoneWeight.x
-	         + uBonesIT[int(aBoneIndex.y)] * norm * aBoneWeight.y;
+	vec3 nrm = norm * uBonesIT[int(aBoneIndex.x)] * aBoneWeight.x
+	         + norm * uBonesIT[int(aBoneIndex.y)] * aBoneWeight.y;
 #elif NUM_WEIGHTS == 3
-	vec4 pos = uBones[int(aBoneIndex.x)] * vert * aBoneWeight.x
-	         + uBones[int(aBoneIndex.y)] * vert * aBoneWeight.y
-	         + uBones[int(aBoneIndex.z)] * vert * aBoneWeight.z;
+	vec3 pos = vert * uBones[int(aBoneIndex.x)] * aBoneWeight.x
+	         + vert * uBones[int(aBoneIndex.y)] * aBoneWeight.y
+	         + vert * uBones[int(aBoneIndex.z)] * aBoneWeight.z;
 
-	vec4 nrm = uBonesIT[int(aBoneIndex.x)] * norm * aBoneWeight.x
-	         + uBonesIT[int(aBoneIndex.y)] * norm * aBoneWeight.y
-	         + uBonesIT[int(aBoneIndex.z)] * norm * aBoneWeight.z;
+	vec3 nrm = norm * uBonesIT[int(aBoneIndex.x)] * aBoneWeight.x
+	         + norm * uBonesIT[int(aBoneIndex.y)] * aBoneWeight.y
+	         + norm * uBonesIT[int(aBoneIndex.z)] * aBoneWeight.z;
 #elif NUM_WEIGHTS == 4
-	vec4 pos = uBones[int(aBoneIndex.x)] * vert * aBoneWeight.x
-	         + uBones[int(aBoneIndex.y)] * vert * aBoneWeight.y
-	         + uBones[int(aBoneIndex.z)] * vert * aBoneWeight.z
-	         + uBones[int(aBoneIndex.w)] * vert * aBoneWeight.w;
-
-	vec4 nrm = uBonesIT[int(aBoneIndex.x)] * norm * aBoneWeight.x
-	         + uBonesIT[int(aBoneIndex.y)] * norm * aBoneWeight.y
-	         + uBonesIT[int(aBoneIndex.z)] * norm * aBoneWeight.z
-	         + uBonesIT[int(aBoneIndex.w)] * norm * aBoneWeight.w;
+	vec3 pos = vert * uBones[int(aBoneIndex.x)] * aBoneWeight.x
+	         + vert * uBones[int(aBoneIndex.y)] * aBoneWeight.y
+	         + vert * uBones[int(aBoneIndex.z)] * aBoneWeight.z
+	         + vert * uBones[int(aBoneIndex.w)] * aBoneWeight.w;
+
+	vec3 nrm = norm * uBonesIT[int(aBoneIndex.x)] * aBoneWeight.x
+	         + norm * uBonesIT[int(aBoneIndex.y)] * aBoneWeight.y
+	         + norm * uBonesIT[int(aBoneIndex.z)] * aBoneWeight.z
+	         + norm * uBonesIT[int(aBoneIndex.w)] * aBoneWeight.w;
 #else
 #endif
 
-	vNormal = nrm.xyz;
-	gl_Position = uViewProjection * pos;
+	vNormal = nrm;
+	gl_Position = uViewProjection * vec4(pos, 1.0);
 }
-
@@ -49,6 +49,31 @@ void debug_draw_point(Vec3 p, Vec3 color=vec3(1.0f, 0.0f, 0.0f))
 	point->color = color;
 }
 
+// Rings at both ends joined by four lines
+void debug_draw_capsule(const Capsule& c, Vec3 color=vec3(1.0f, 0.0f, 0.0f))
+{
+	Vec3 axis = c.b - c.a;
+	Vec3 up = fabsf(axis.y) < fabsf(axis.x) ? vec3(0.0f, 1.0f, 0.0f) : vec3(1.0f, 0.0f, 0.0f);
+	Vec3 u = normalize(cross(axis, up)) * c.radius;
+	Vec3 v = normalize(cross(axis, u)) * c.radius;
+	if (length_squared(axis) == 0.0f) {
+		u = vec3(c.radius, 0.0f, 0.0f);
+		v = vec3(0.0f, 0.0f, c.radius);
+	}
+
+	const U32 segments = 12;
+	for (U32 i = 0; i < segments; i++) {
+		float a0 = (float)i / (float)segments * 2.0f * FLT_PI;
+		float a1 = (float)(i + 1) / (float)segments * 2.0f * FLT_PI;
+		Vec3 p0 = u * cosf(a0) + v * sinf(a0);
+		Vec3 p1 = u * cosf(a1) + v * sinf(a1);
+		debug_draw_line(c.a + p0, c.a + p1, color);
+		debug_draw_line(c.b + p0, c.b + p1, color);
+		if (i % 3 == 0)
+			debug_draw_line(c.a + p0, c.b + p0, color);
+	}
+}
+
 void debug_draw_render()
 {
 	glBegin(GL_LINES);
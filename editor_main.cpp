@@ -33,21 +33,21 @@ int main(int argc, char **argv)
 	Model_File_Data *model = load_model_file(argv[1], 0);
 	GL_Skinned_Mesh gl_mesh = { 0 };
 
-	Mat44 *world_transform = (Mat44*)malloc(sizeof(Mat44) * model->node_count);
+	Mat34 *world_transform = (Mat34*)malloc(sizeof(Mat34) * model->node_count);
+	Trs *local_transform = (Trs*)malloc(sizeof(Trs) * model->node_count);
+	U32 *node_parent = (U32*)malloc(sizeof(U32) * model->node_count);
 
 	for (U32 i = 0; i < model->node_count; i++) {
 		Node *node = &model->nodes[i];
 
-		if (node->parent) {
-			world_transform[i] = node->transform * world_transform[node->parent - model->nodes];
-		} else {
-			world_transform[i] = node->transform;
-		}
+		node_parent[i] = node->parent ? (U32)(node->parent - model->nodes) : ~0u;
+		local_transform[i] = node->transform;
 	}
+	trs_compose_batch(world_transform, local_transform, node_parent, model->node_count);
 
-	int bone_mapping[64];
-	Mat44 bone_inv[64];
-	Mat44 bones[64];
+	U32 bone_mapping[64];
+	Mat34 bone_inv[64];
+	Mat34 bones[64];
 
 	{
 		Mesh *mesh = &model->meshes[0];
@@ -71,9 +71,9 @@ int main(int argc, char **argv)
 
 		Out_Stream outs = { 0 };
 
-		stream_write(&outs, &mesh->bone_count, sizeof(U32));
-		stream_write(&outs, bone_inv, sizeof(Mat44), mesh->bone_count);
-		stream_write(&outs, bones, sizeof(Mat44), mesh->bone_count);
+		stream_write32(&outs, mesh->bone_count);
+		stream_write_f32(&outs, bone_inv[0].data, 12 * mesh->bone_count);
+		stream_write_f32(&outs, bones[0].data, 12 * mesh->bone_count);
 		write_skinned_mesh(&outs, &gl_mesh);
 
 		FILE *f = fopen("bin/out.bin", "wb");
@@ -90,6 +90,43 @@ int main(int argc, char **argv)
 
 	Vec3 *temp_transform_buffer = (Vec3*)malloc(sizeof(Vec3) * 1024 * 32);
 
+	// Static meshes are picked in node space, the skinned mesh in the space of
+	// each bone so the BVHs never need to follow the pose
+	Bvh *mesh_bvhs = (Bvh*)calloc(model->mesh_count, sizeof(Bvh));
+	for (U32 i = 0; i < model->mesh_count; i++) {
+		Mesh *mesh = &model->meshes[i];
+		if (mesh->bone_count)
+			continue;
+
+		if (!bvh_build(&mesh_bvhs[i], mesh->positions, mesh->indices, mesh->index_count / 3)) {
+			fprintf(stderr, "Could not build BVH for %s\n", mesh->name);
+			return 1;
+		}
+	}
+
+	Skinned_Bvh skinned_bvh = { 0 };
+	{
+		Mesh *mesh = &model->meshes[0];
+		if (mesh->bone_count && !skinned_bvh_build(&skinned_bvh, mesh->positions, mesh->indices, mesh->index_count / 3,
+					mesh->bone_indices, mesh->bone_weights, mesh->bones_per_vertex, mesh->bone_count)) {
+			fprintf(stderr, "Could not build BVH for %s\n", mesh->name);
+			return 1;
+		}
+	}
+
+	// Coarse per-bone proxies for hover highlighting
+	Capsule bone_capsules[64];
+	U32 bone_capsule_count = 0;
+	if (fit_bone_capsules(bone_capsules, &model->meshes[0], 0.5f))
+		bone_capsule_count = model->meshes[0].bone_count;
+
+	int picked_node = -1;
+	Mesh *picked_mesh = 0;
+	U32 picked_triangle = 0;
+	float pick_microseconds = 0.0f;
+
+	Skinned_Normal_Cache normal_cache = { 0 };
+
 	float yaw = 0.0f;
 	float pitch = 0.0f;
 	Vec3 camera_target = vec3(0.0f, 0.0f, 0.0f);
@@ -115,6 +152,19 @@ int main(int argc, char **argv)
 		}
 	}
 
+	// Only widgets whose bounds the mouse ray enters get the exact pick
+	Aabb_Tree widget_tree;
+	aabb_tree_init(&widget_tree, 0.5f);
+	U32 widget_proxies[64];
+	for (U32 i = 0; i < edit_object_count; i++) {
+		editor_widget_set_mat34(&edit_widgets[i], world_transform[edit_nodes[i]]);
+		widget_proxies[i] = aabb_tree_insert(&widget_tree, editor_widget_bounds(&edit_widgets[i]), i);
+		if (widget_proxies[i] == AABB_TREE_NULL) {
+			fprintf(stderr, "Could not insert widget\n");
+			return 1;
+		}
+	}
+
 	while (!glfwWindowShouldClose(window)) {
 		double time = glfwGetTime();
 
@@ -190,7 +240,11 @@ int main(int argc, char **argv)
 			float closest = FLT_MAX;
 			int closest_i = -1;
 
-			for (U32 i = 0; i < edit_object_count; i++) {
+			U32 candidates[64];
+			U32 candidate_count = aabb_tree_query_ray(&widget_tree, mouse_ray, FLT_MAX, candidates, (U32)Count(candidates));
+
+			for (U32 ci = 0; ci < candidate_count; ci++) {
+				U32 i = candidates[ci];
 				float dist = editor_widget_pick(&edit_widgets[i], editor_mouse);
 				if (dist < 0.0f) continue;
 
@@ -202,18 +256,65 @@ int main(int argc, char **argv)
 
 			if (closest_i >= 0) {
 				edit_widgets[closest_i].is_active = true;
+			} else if (editor_mouse.is_pressed && !prev_editor_mouse.is_pressed) {
+				double pick_begin = glfwGetTime();
+				float pick_t = FLT_MAX;
+				picked_node = -1;
+
+				// Same palette the mesh was drawn with last frame
+				Mat34 pick_palette[64];
+				mat34_mul_batch_indexed(pick_palette, bone_inv, world_transform, bone_mapping, gl_mesh.bone_count);
+
+				for (U32 nodeI = 0; nodeI < model->node_count; nodeI++) {
+					Node *node = &model->nodes[nodeI];
+
+					for (U32 meshI = 0; meshI < node->mesh_count; meshI++) {
+						Mesh *mesh = node->meshes[meshI];
+						Bvh_Hit hit;
+
+						if (mesh == &model->meshes[0] && mesh->bone_count) {
+							hit = skinned_bvh_intersect_closest(&skinned_bvh, mouse_ray, pick_palette, pick_t);
+						} else if (!mesh->bone_count) {
+							Mat34 to_local = inverse(world_transform[nodeI]);
+							Ray ray = ray_to_dir(mouse_ray.origin * to_local, transform_direction(mouse_ray.direction, to_local));
+							hit = bvh_intersect_closest(&mesh_bvhs[mesh - model->meshes], ray, pick_t);
+						} else {
+							// Only the first mesh is drawn skinned
+							continue;
+						}
+
+						if (hit.hit) {
+							pick_t = hit.t;
+							picked_node = (int)nodeI;
+							picked_mesh = mesh;
+							picked_triangle = hit.triangle;
+						}
+					}
+				}
+
+				pick_microseconds = (float)((glfwGetTime() - pick_begin) * 1e6);
 			}
 		}
 
 		for (U32 i = 0; i < edit_object_count; i++) {
 			if (!edit_widgets[i].is_active) continue;
 
-			Mat44 xform;
-			if (editor_widget_update(&edit_widgets[i], editor_mouse, prev_editor_mouse, &xform)) {
+			Trs delta;
+			if (editor_widget_update(&edit_widgets[i], editor_mouse, prev_editor_mouse, &delta)) {
 				Node *node = &model->nodes[edit_nodes[i]];
-				const Mat44& parent = world_transform[node->parent - model->nodes];
+				Mat34 to_parent = node->parent ? inverse(world_transform[node->parent - model->nodes]) : mat34_identity;
+
+				// The delta rotates around the node origin, so only the axis
+				// needs to be brought to parent space
+				Vec3 axis = vec3(delta.rotation.x, delta.rotation.y, delta.rotation.z);
+				float axis_len = length(axis);
+				if (axis_len > 0.0f) {
+					Vec3 local_axis = normalize(transform_direction(axis, to_parent)) * axis_len;
+					Quat rotation = quat(local_axis.x, local_axis.y, local_axis.z, delta.rotation.w);
+					node->transform.rotation = normalize(node->transform.rotation * rotation);
+				}
 
-				node->transform = world_transform[edit_nodes[i]] * xform * inverse(parent);
+				node->transform.translation += transform_direction(delta.translation, to_parent);
 			}
 		}
 
@@ -224,18 +325,28 @@ int main(int argc, char **argv)
 		Mat44 mat = mat44_rotate_x(sinf((float)time));
 
 		for (U32 i = 0; i < model->node_count; i++) {
-			Node *node = &model->nodes[i];
-
-			if (node->parent) {
-				world_transform[i] = node->transform * world_transform[node->parent - model->nodes];
-			} else {
-				world_transform[i] = node->transform;
-			}
+			local_transform[i] = model->nodes[i].transform;
 		}
+		trs_compose_batch(world_transform, local_transform, node_parent, model->node_count);
 
 		for (U32 i = 0; i < edit_object_count; i++) {
-			editor_widget_set_mat44(&edit_widgets[i], world_transform[edit_nodes[i]]);
+			editor_widget_set_mat34(&edit_widgets[i], world_transform[edit_nodes[i]]);
 			editor_widget_set_camera_pos(&edit_widgets[i], camera);
+			aabb_tree_move(&widget_tree, widget_proxies[i], editor_widget_bounds(&edit_widgets[i]));
+		}
+
+		if (bone_capsule_count && !ImGui::GetIO().WantCaptureMouse) {
+			Capsule posed[64];
+			Capsule_Packet4 capsule_packets[16];
+			for (U32 i = 0; i < bone_capsule_count; i++)
+				posed[i] = capsule_transform(bone_capsules[i], world_transform[bone_mapping[i]]);
+			capsule_packets_set(capsule_packets, posed, bone_capsule_count);
+
+			Ray_Capsule_Hit hover = intersect_ray_capsules(mouse_ray, capsule_packets, bone_capsule_count, FLT_MAX);
+			if (hover.hit) {
+				ImGui::Text("Hover %s", model->meshes[0].bones[hover.capsule].name);
+				debug_draw_capsule(posed[hover.capsule], vec3(0.0f, 1.0f, 1.0f));
+			}
 		}
 
 		glEnable(GL_DEPTH_TEST);
@@ -260,15 +371,21 @@ int main(int argc, char **argv)
 			glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
 		}
 
+		static bool do_dual_quat = false;
+		ImGui::Checkbox("Dual quaternion skinning", &do_dual_quat);
+
 		{
-			Mat44 bone_trans[64];
+			Mat34 bone_trans[64];
 			Mat44 vp = transpose(view * proj);
 
-			for (U32 i = 0; i < gl_mesh.bone_count; i++) {
-				const Mat44 &world = world_transform[bone_mapping[i]];
-				bone_trans[i] = transpose(bone_inv[i] * world);
+			mat34_mul_batch_indexed(bone_trans, bone_inv, world_transform, bone_mapping, gl_mesh.bone_count);
+			if (do_dual_quat) {
+				Dual_Quat bone_dq[64];
+				dual_quat_batch(bone_dq, bone_trans, gl_mesh.bone_count);
+				draw_skinned_mesh_dq(&gl_mesh, vp, bone_dq);
+			} else {
+				draw_skinned_mesh(&gl_mesh, vp, bone_trans, &normal_cache);
 			}
-			draw_skinned_mesh(&gl_mesh, vp, bone_trans);
 		}
 
 		glBindBuffer(GL_ARRAY_BUFFER, 0);
@@ -282,6 +399,23 @@ int main(int argc, char **argv)
 			editor_widget_draw(&edit_widgets[i]);
 		}
 
+		if (picked_node >= 0) {
+			ImGui::Text("Picked %s (%.1f us)", model->nodes[picked_node].name, pick_microseconds);
+
+			const U32 *tri = &picked_mesh->indices[picked_triangle * 3];
+			Mat34 to_world = world_transform[picked_node];
+			if (picked_mesh->bone_count) {
+				U32 bone = skinned_bvh.triangle_bone[picked_triangle];
+				to_world = bone_inv[bone] * world_transform[bone_mapping[bone]];
+			}
+			Vec3 a = picked_mesh->positions[tri[0]] * to_world;
+			Vec3 b = picked_mesh->positions[tri[1]] * to_world;
+			Vec3 c = picked_mesh->positions[tri[2]] * to_world;
+			debug_draw_line(a, b, vec3(1.0f, 1.0f, 0.0f));
+			debug_draw_line(b, c, vec3(1.0f, 1.0f, 0.0f));
+			debug_draw_line(c, a, vec3(1.0f, 1.0f, 0.0f));
+		}
+
 		static bool do_debug_draw = true;
 		ImGui::Checkbox("Debug debug lines", &do_debug_draw);
 		if (do_debug_draw) {
@@ -296,6 +430,13 @@ int main(int argc, char **argv)
 		glfwPollEvents();
 	}
 
+	for (U32 i = 0; i < model->mesh_count; i++) {
+		bvh_free(&mesh_bvhs[i]);
+	}
+	free(mesh_bvhs);
+	skinned_bvh_free(&skinned_bvh);
+	aabb_tree_free(&widget_tree);
+
 	free_model_file(model);
 
 	ImGui_ImplGlfw_Shutdown();
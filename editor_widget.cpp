@@ -41,7 +41,7 @@ const Editor_Widget_Plane editor_widget_planes[] = {
 	{ 1, 2, 0 },
 };
 
-void editor_widget_set_mat44(Editor_Widget *w, const Mat44& m)
+void editor_widget_set_mat34(Editor_Widget *w, const Mat34& m)
 {
 	w->position = vec3(m._14, m._24, m._34);
 	w->axes[0] = vec3(m._11, m._21, m._31);
@@ -49,6 +49,20 @@ void editor_widget_set_mat44(Editor_Widget *w, const Mat44& m)
 	w->axes[2] = vec3(m._13, m._23, m._33);
 }
 
+// Bounds of everything editor_widget_pick can hit
+Aabb editor_widget_bounds(const Editor_Widget *w)
+{
+	float axis_length = 0.0f;
+	for (int i = 0; i < 3; i++)
+		axis_length = MMAX(axis_length, length(w->axes[i]) * 2.0f);
+
+	float extent = MMAX(axis_length + w->axis_pick_distance, 2.15f);
+	Aabb ret;
+	ret.min = w->position - vec3(extent, extent, extent);
+	ret.max = w->position + vec3(extent, extent, extent);
+	return ret;
+}
+
 struct Editor_Mouse_State
 {
 	Ray world_ray;
@@ -166,7 +180,8 @@ float editor_widget_pick(Editor_Widget *w, Editor_Mouse_State mouse)
 	return -1.0f;
 }
 
-bool editor_widget_update(Editor_Widget *w, Editor_Mouse_State mouse, Editor_Mouse_State prev_mouse, Mat44 *transform)
+// Outputs the world space change, rotations are around the widget position
+bool editor_widget_update(Editor_Widget *w, Editor_Mouse_State mouse, Editor_Mouse_State prev_mouse, Trs *delta)
 {
 	if (!mouse.is_pressed) {
 		w->selected_part = Editor_Widget_Part_None;
@@ -194,7 +209,8 @@ bool editor_widget_update(Editor_Widget *w, Editor_Mouse_State mouse, Editor_Mou
 		Vec3 prev_pos = ray_at(axis, prev_ts.t1);
 		Vec3 cur_pos = ray_at(axis, cur_ts.t1);
 
-		*transform = mat44_translate(cur_pos - prev_pos);
+		*delta = trs_identity;
+		delta->translation = cur_pos - prev_pos;
 		return true;
 	}
 
@@ -211,7 +227,8 @@ bool editor_widget_update(Editor_Widget *w, Editor_Mouse_State mouse, Editor_Mou
 		Vec3 prev_pos = ray_at(prev_mouse.world_ray, prev_ts.t);
 		Vec3 cur_pos = ray_at(mouse.world_ray, cur_ts.t);
 
-		*transform = mat44_translate(cur_pos - prev_pos);
+		*delta = trs_identity;
+		delta->translation = cur_pos - prev_pos;
 		return true;
 	}
 
@@ -242,9 +259,8 @@ bool editor_widget_update(Editor_Widget *w, Editor_Mouse_State mouse, Editor_Mou
 
 		float angle = atan2f(cur_flat.y, cur_flat.x) - atan2f(prev_flat.y, prev_flat.x);
 
-		*transform = mat44_translate(-w->position)
-				* mat44_rotate_axis(w->axes[plane.normal], -angle)
-				* mat44_translate(w->position);
+		*delta = trs_identity;
+		delta->rotation = quat_normalized_axis_angle(norm, -angle);
 		return true;
 	}
 
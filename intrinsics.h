@@ -1,6 +1,36 @@
 
 #ifdef HAS_SSE2
 #include <xmmintrin.h>
+#include <emmintrin.h>
+
+// Kernels for newer instruction sets are compiled per function with
+// CPU_TARGET and picked at runtime by cpu.cpp. Building with -mavx -DHAS_AVX
+// (/arch:AVX on MSVC) additionally makes AVX the baseline for single operations.
+#if defined(__GNUC__) || defined(__clang__)
+	#define CPU_TARGET(isa) __attribute__((target(isa)))
+	#define HAS_DISPATCH_SSE41
+	#define HAS_DISPATCH_AVX
+	#define HAS_DISPATCH_AVX2
+	#define HAS_DISPATCH_AVX512
+#elif defined(_MSC_VER)
+	#define CPU_TARGET(isa)
+	#define HAS_DISPATCH_SSE41
+	#define HAS_DISPATCH_AVX
+	#if _MSC_VER >= 1700
+		#define HAS_DISPATCH_AVX2
+	#endif
+	#if _MSC_VER >= 1911
+		#define HAS_DISPATCH_AVX512
+	#endif
+#endif
+
+#ifdef HAS_DISPATCH_SSE41
+#include <smmintrin.h>
+#endif
+#ifdef HAS_DISPATCH_AVX
+#include <immintrin.h>
+#endif
+
 #endif
 
 #ifdef HAS_SSE2
@@ -25,4 +55,3 @@ inline float mmax_impl(float a, float b)
 #define MSQRT(a) (sqrtf(a))
 
 #endif
-
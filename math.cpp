@@ -15,6 +15,31 @@ struct Mat44
 	};
 };
 
+// Affine transform, the implicit last row is (0, 0, 0, 1)
+struct Mat34
+{
+	union {
+		float data[12];
+		struct {
+			float _11, _12, _13, _14;
+			float _21, _22, _23, _24;
+			float _31, _32, _33, _34;
+		};
+	};
+};
+
+struct Mat33
+{
+	union {
+		float data[9];
+		struct {
+			float _11, _12, _13;
+			float _21, _22, _23;
+			float _31, _32, _33;
+		};
+	};
+};
+
 struct Vec2
 {
 	float x, y;
@@ -30,6 +55,27 @@ struct Vec4
 	float x, y, z, w;
 };
 
+struct Quat
+{
+	float x, y, z, w;
+};
+
+// Local transform: scale, then rotate, then translate
+struct Trs
+{
+	Quat rotation;
+	Vec3 translation;
+	Vec3 scale;
+};
+
+// Rigid transform as a unit dual quaternion, the dual part encodes the
+// translation as 0.5 * t * real
+struct Dual_Quat
+{
+	Quat real;
+	Quat dual;
+};
+
 Vec2 vec2(float x, float y)
 {
 	Vec2 ret;
@@ -227,6 +273,16 @@ Vec3 normalize(const Vec3& a)
 	return a * (1.0f / length(a));
 }
 
+Vec3 vec3_min(const Vec3& a, const Vec3& b)
+{
+	return vec3(MMIN(a.x, b.x), MMIN(a.y, b.y), MMIN(a.z, b.z));
+}
+
+Vec3 vec3_max(const Vec3& a, const Vec3& b)
+{
+	return vec3(MMAX(a.x, b.x), MMAX(a.y, b.y), MMAX(a.z, b.z));
+}
+
 const Mat44 mat44_identity = {
 	1.0f, 0.0f, 0.0f, 0.0f,
 	0.0f, 1.0f, 0.0f, 0.0f,
@@ -400,7 +456,7 @@ Mat44 mat44_perspective(float fov, float aspect, float near_z, float far_z)
 	return ret;
 }
 
-Mat44 operator*(const Mat44& a, const Mat44& b)
+Mat44 mat44_mul_scalar(const Mat44& a, const Mat44& b)
 {
 	Mat44 ret;
 
@@ -427,7 +483,7 @@ Mat44 operator*(const Mat44& a, const Mat44& b)
 	return ret;
 }
 
-Mat44 transpose(const Mat44& a)
+Mat44 mat44_transpose_scalar(const Mat44& a)
 {
 	Mat44 ret;
 
@@ -462,12 +518,12 @@ float determinant(const Mat44& a)
 		+ a._13*a._21*a._32*a._44 + a._13*a._22*a._34*a._41 + a._13*a._24*a._31*a._42
 		+ a._14*a._21*a._33*a._42 + a._14*a._22*a._31*a._43 + a._14*a._23*a._32*a._41
 		- a._11*a._22*a._34*a._43 - a._11*a._23*a._32*a._44 - a._11*a._24*a._33*a._42
-		- a._12*a._21*a._33*a._44 - a._11*a._23*a._34*a._41 - a._12*a._24*a._31*a._43
+		- a._12*a._21*a._33*a._44 - a._12*a._23*a._34*a._41 - a._12*a._24*a._31*a._43
 		- a._13*a._21*a._34*a._42 - a._13*a._22*a._31*a._44 - a._13*a._24*a._32*a._41
 		- a._14*a._21*a._32*a._43 - a._14*a._22*a._33*a._41 - a._14*a._23*a._31*a._42;
 }
 
-Mat44 inverse(const Mat44& mat)
+Mat44 mat44_inverse_scalar(const Mat44& mat)
 {
 	Mat44 ret;
 
@@ -510,6 +566,189 @@ Mat44 inverse(const Mat44& mat)
 	return ret;
 }
 
+#ifdef HAS_SSE2
+
+// Note: The SIMD kernels use the same operation order as the scalar versions
+// so multiply and transpose are bit-exact, inverse differs in rounding only.
+
+Mat44 mat44_mul_sse2(const Mat44& a, const Mat44& b)
+{
+	Mat44 ret;
+
+	__m128 a0 = _mm_loadu_ps(a.data + 0);
+	__m128 a1 = _mm_loadu_ps(a.data + 4);
+	__m128 a2 = _mm_loadu_ps(a.data + 8);
+	__m128 a3 = _mm_loadu_ps(a.data + 12);
+
+	for (int i = 0; i < 4; i++) {
+		__m128 bi = _mm_loadu_ps(b.data + i * 4);
+		__m128 r = _mm_mul_ps(a0, _mm_shuffle_ps(bi, bi, _MM_SHUFFLE(0,0,0,0)));
+		r = _mm_add_ps(r, _mm_mul_ps(a1, _mm_shuffle_ps(bi, bi, _MM_SHUFFLE(1,1,1,1))));
+		r = _mm_add_ps(r, _mm_mul_ps(a2, _mm_shuffle_ps(bi, bi, _MM_SHUFFLE(2,2,2,2))));
+		r = _mm_add_ps(r, _mm_mul_ps(a3, _mm_shuffle_ps(bi, bi, _MM_SHUFFLE(3,3,3,3))));
+		_mm_storeu_ps(ret.data + i * 4, r);
+	}
+
+	return ret;
+}
+
+Mat44 mat44_transpose_sse2(const Mat44& a)
+{
+	Mat44 ret;
+
+	__m128 r0 = _mm_loadu_ps(a.data + 0);
+	__m128 r1 = _mm_loadu_ps(a.data + 4);
+	__m128 r2 = _mm_loadu_ps(a.data + 8);
+	__m128 r3 = _mm_loadu_ps(a.data + 12);
+
+	_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+
+	_mm_storeu_ps(ret.data + 0, r0);
+	_mm_storeu_ps(ret.data + 4, r1);
+	_mm_storeu_ps(ret.data + 8, r2);
+	_mm_storeu_ps(ret.data + 12, r3);
+
+	return ret;
+}
+
+Mat44 mat44_inverse_sse2(const Mat44& mat)
+{
+	// Cramer's rule, Intel AP-928 "Streaming SIMD Extensions - Inverse of 4x4 Matrix"
+	__m128 row0 = _mm_loadu_ps(mat.data + 0);
+	__m128 row1 = _mm_loadu_ps(mat.data + 4);
+	__m128 row2 = _mm_loadu_ps(mat.data + 8);
+	__m128 row3 = _mm_loadu_ps(mat.data + 12);
+
+	_MM_TRANSPOSE4_PS(row0, row1, row2, row3);
+	row1 = _mm_shuffle_ps(row1, row1, 0x4E);
+	row3 = _mm_shuffle_ps(row3, row3, 0x4E);
+
+	__m128 minor0, minor1, minor2, minor3, tmp;
+
+	tmp = _mm_mul_ps(row2, row3);
+	tmp = _mm_shuffle_ps(tmp, tmp, 0xB1);
+	minor0 = _mm_mul_ps(row1, tmp);
+	minor1 = _mm_mul_ps(row0, tmp);
+	tmp = _mm_shuffle_ps(tmp, tmp, 0x4E);
+	minor0 = _mm_sub_ps(_mm_mul_ps(row1, tmp), minor0);
+	minor1 = _mm_sub_ps(_mm_mul_ps(row0, tmp), minor1);
+	minor1 = _mm_shuffle_ps(minor1, minor1, 0x4E);
+
+	tmp = _mm_mul_ps(row1, row2);
+	tmp = _mm_shuffle_ps(tmp, tmp, 0xB1);
+	minor0 = _mm_add_ps(_mm_mul_ps(row3, tmp), minor0);
+	minor3 = _mm_mul_ps(row0, tmp);
+	tmp = _mm_shuffle_ps(tmp, tmp, 0x4E);
+	minor0 = _mm_sub_ps(minor0, _mm_mul_ps(row3, tmp));
+	minor3 = _mm_sub_ps(_mm_mul_ps(row0, tmp), minor3);
+	minor3 = _mm_shuffle_ps(minor3, minor3, 0x4E);
+
+	tmp = _mm_mul_ps(_mm_shuffle_ps(row1, row1, 0x4E), row3);
+	tmp = _mm_shuffle_ps(tmp, tmp, 0xB1);
+	row2 = _mm_shuffle_ps(row2, row2, 0x4E);
+	minor0 = _mm_add_ps(_mm_mul_ps(row2, tmp), minor0);
+	minor2 = _mm_mul_ps(row0, tmp);
+	tmp = _mm_shuffle_ps(tmp, tmp, 0x4E);
+	minor0 = _mm_sub_ps(minor0, _mm_mul_ps(row2, tmp));
+	minor2 = _mm_sub_ps(_mm_mul_ps(row0, tmp), minor2);
+	minor2 = _mm_shuffle_ps(minor2, minor2, 0x4E);
+
+	tmp = _mm_mul_ps(row0, row1);
+	tmp = _mm_shuffle_ps(tmp, tmp, 0xB1);
+	minor2 = _mm_add_ps(_mm_mul_ps(row3, tmp), minor2);
+	minor3 = _mm_sub_ps(_mm_mul_ps(row2, tmp), minor3);
+	tmp = _mm_shuffle_ps(tmp, tmp, 0x4E);
+	minor2 = _mm_sub_ps(_mm_mul_ps(row3, tmp), minor2);
+	minor3 = _mm_sub_ps(minor3, _mm_mul_ps(row2, tmp));
+
+	tmp = _mm_mul_ps(row0, row3);
+	tmp = _mm_shuffle_ps(tmp, tmp, 0xB1);
+	minor1 = _mm_sub_ps(minor1, _mm_mul_ps(row2, tmp));
+	minor2 = _mm_add_ps(_mm_mul_ps(row1, tmp), minor2);
+	tmp = _mm_shuffle_ps(tmp, tmp, 0x4E);
+	minor1 = _mm_add_ps(_mm_mul_ps(row2, tmp), minor1);
+	minor2 = _mm_sub_ps(minor2, _mm_mul_ps(row1, tmp));
+
+	tmp = _mm_mul_ps(row0, row2);
+	tmp = _mm_shuffle_ps(tmp, tmp, 0xB1);
+	minor1 = _mm_add_ps(_mm_mul_ps(row3, tmp), minor1);
+	minor3 = _mm_sub_ps(minor3, _mm_mul_ps(row1, tmp));
+	tmp = _mm_shuffle_ps(tmp, tmp, 0x4E);
+	minor1 = _mm_sub_ps(minor1, _mm_mul_ps(row3, tmp));
+	minor3 = _mm_add_ps(_mm_mul_ps(row1, tmp), minor3);
+
+	__m128 det = _mm_mul_ps(row0, minor0);
+	det = _mm_add_ps(_mm_shuffle_ps(det, det, 0x4E), det);
+	det = _mm_add_ss(_mm_shuffle_ps(det, det, 0xB1), det);
+	assert(fabs(_mm_cvtss_f32(det)) > 0.0f);
+
+	__m128 idet = _mm_div_ps(_mm_set1_ps(1.0f), _mm_shuffle_ps(det, det, 0x00));
+
+	Mat44 ret;
+	_mm_storeu_ps(ret.data + 0, _mm_mul_ps(minor0, idet));
+	_mm_storeu_ps(ret.data + 4, _mm_mul_ps(minor1, idet));
+	_mm_storeu_ps(ret.data + 8, _mm_mul_ps(minor2, idet));
+	_mm_storeu_ps(ret.data + 12, _mm_mul_ps(minor3, idet));
+	return ret;
+}
+
+#endif
+
+#ifdef HAS_DISPATCH_AVX
+
+CPU_TARGET("avx") Mat44 mat44_mul_avx(const Mat44& a, const Mat44& b)
+{
+	Mat44 ret;
+
+	__m256 a0 = _mm256_broadcast_ps((const __m128*)(a.data + 0));
+	__m256 a1 = _mm256_broadcast_ps((const __m128*)(a.data + 4));
+	__m256 a2 = _mm256_broadcast_ps((const __m128*)(a.data + 8));
+	__m256 a3 = _mm256_broadcast_ps((const __m128*)(a.data + 12));
+
+	// Two rows of the result per iteration
+	for (int i = 0; i < 2; i++) {
+		__m256 bi = _mm256_loadu_ps(b.data + i * 8);
+		__m256 r = _mm256_mul_ps(a0, _mm256_shuffle_ps(bi, bi, _MM_SHUFFLE(0,0,0,0)));
+		r = _mm256_add_ps(r, _mm256_mul_ps(a1, _mm256_shuffle_ps(bi, bi, _MM_SHUFFLE(1,1,1,1))));
+		r = _mm256_add_ps(r, _mm256_mul_ps(a2, _mm256_shuffle_ps(bi, bi, _MM_SHUFFLE(2,2,2,2))));
+		r = _mm256_add_ps(r, _mm256_mul_ps(a3, _mm256_shuffle_ps(bi, bi, _MM_SHUFFLE(3,3,3,3))));
+		_mm256_storeu_ps(ret.data + i * 8, r);
+	}
+
+	return ret;
+}
+
+#endif
+
+Mat44 operator*(const Mat44& a, const Mat44& b)
+{
+#if defined(HAS_AVX)
+	return mat44_mul_avx(a, b);
+#elif defined(HAS_SSE2)
+	return mat44_mul_sse2(a, b);
+#else
+	return mat44_mul_scalar(a, b);
+#endif
+}
+
+Mat44 transpose(const Mat44& a)
+{
+#if defined(HAS_SSE2)
+	return mat44_transpose_sse2(a);
+#else
+	return mat44_transpose_scalar(a);
+#endif
+}
+
+Mat44 inverse(const Mat44& mat)
+{
+#if defined(HAS_SSE2)
+	return mat44_inverse_sse2(mat);
+#else
+	return mat44_inverse_scalar(mat);
+#endif
+}
+
 Mat44& operator*=(Mat44& a, const Mat44& b)
 {
 	a = a * b;
@@ -539,3 +778,1005 @@ Vec4 operator*(const Vec4& vec, const Mat44& mat)
 	return ret;
 }
 
+
+// Batch transforms: `dst` may alias `src`
+
+#ifdef HAS_SSE2
+
+// Load four AoS Vec3 (12 floats) as X, Y, Z lanes
+#define MATH_LOAD_VEC3X4(src, X, Y, Z) do { \
+		__m128 a_ = _mm_loadu_ps((const float*)(src) + 0); \
+		__m128 b_ = _mm_loadu_ps((const float*)(src) + 4); \
+		__m128 c_ = _mm_loadu_ps((const float*)(src) + 8); \
+		__m128 xy_ = _mm_shuffle_ps(b_, c_, _MM_SHUFFLE(2,1,3,2)); \
+		__m128 yz_ = _mm_shuffle_ps(a_, b_, _MM_SHUFFLE(1,0,2,1)); \
+		X = _mm_shuffle_ps(a_, xy_, _MM_SHUFFLE(2,0,3,0)); \
+		Y = _mm_shuffle_ps(yz_, xy_, _MM_SHUFFLE(3,1,2,0)); \
+		Z = _mm_shuffle_ps(yz_, c_, _MM_SHUFFLE(3,0,3,1)); \
+	} while (0)
+
+#define MATH_STORE_VEC3X4(dst, X, Y, Z) do { \
+		__m128 xy01_ = _mm_unpacklo_ps(X, Y); \
+		__m128 xy23_ = _mm_unpackhi_ps(X, Y); \
+		__m128 zx_ = _mm_shuffle_ps(Z, X, _MM_SHUFFLE(3,1,1,0)); \
+		__m128 yz_ = _mm_shuffle_ps(Y, Z, _MM_SHUFFLE(2,1,2,1)); \
+		__m128 zx3_ = _mm_shuffle_ps(Z, X, _MM_SHUFFLE(3,3,2,2)); \
+		__m128 yz3_ = _mm_shuffle_ps(Y, Z, _MM_SHUFFLE(3,3,3,3)); \
+		_mm_storeu_ps((float*)(dst) + 0, _mm_shuffle_ps(xy01_, zx_, _MM_SHUFFLE(2,0,1,0))); \
+		_mm_storeu_ps((float*)(dst) + 4, _mm_shuffle_ps(yz_, xy23_, _MM_SHUFFLE(1,0,2,0))); \
+		_mm_storeu_ps((float*)(dst) + 8, _mm_shuffle_ps(zx3_, yz3_, _MM_SHUFFLE(2,0,2,0))); \
+	} while (0)
+
+// Broadcast the affine part of a matrix to lanes, `w` scales the translation
+void math_broadcast_affine(__m128 *m, const Mat44& mat, float w)
+{
+	m[0] = _mm_set1_ps(mat._11); m[1] = _mm_set1_ps(mat._12); m[2] = _mm_set1_ps(mat._13); m[3] = _mm_set1_ps(mat._14 * w);
+	m[4] = _mm_set1_ps(mat._21); m[5] = _mm_set1_ps(mat._22); m[6] = _mm_set1_ps(mat._23); m[7] = _mm_set1_ps(mat._24 * w);
+	m[8] = _mm_set1_ps(mat._31); m[9] = _mm_set1_ps(mat._32); m[10] = _mm_set1_ps(mat._33); m[11] = _mm_set1_ps(mat._34 * w);
+}
+
+// Transform four vectors in X, Y, Z lanes, same operation order as `operator*(Vec3, Mat44)`
+#define MATH_TRANSFORM_X4(m, X, Y, Z, RX, RY, RZ) do { \
+		RX = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(X, m[0]), _mm_mul_ps(Y, m[1])), _mm_mul_ps(Z, m[2])), m[3]); \
+		RY = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(X, m[4]), _mm_mul_ps(Y, m[5])), _mm_mul_ps(Z, m[6])), m[7]); \
+		RZ = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(X, m[8]), _mm_mul_ps(Y, m[9])), _mm_mul_ps(Z, m[10])), m[11]); \
+	} while (0)
+
+#endif
+
+Vec3 transform_direction(const Vec3& vec, const Mat44& mat)
+{
+	Vec3 ret;
+
+	ret.x = vec.x*mat._11 + vec.y*mat._12 + vec.z*mat._13;
+	ret.y = vec.x*mat._21 + vec.y*mat._22 + vec.z*mat._23;
+	ret.z = vec.x*mat._31 + vec.y*mat._32 + vec.z*mat._33;
+
+	return ret;
+}
+
+// Batch kernels, picked at runtime by `math_kernels()`. The AoS kernels
+// take `w` 1 for points and 0 for directions, a null `index` means b[i].
+
+void transform_aos_scalar(Vec3 *dst, const Vec3 *src, size_t count, const Mat44& mat, float w)
+{
+	float m14 = mat._14 * w, m24 = mat._24 * w, m34 = mat._34 * w;
+	for (size_t i = 0; i < count; i++) {
+		Vec3 v = src[i];
+		dst[i].x = v.x*mat._11 + v.y*mat._12 + v.z*mat._13 + m14;
+		dst[i].y = v.x*mat._21 + v.y*mat._22 + v.z*mat._23 + m24;
+		dst[i].z = v.x*mat._31 + v.y*mat._32 + v.z*mat._33 + m34;
+	}
+}
+
+void transform_soa_scalar(float *dst_x, float *dst_y, float *dst_z,
+		const float *x, const float *y, const float *z, size_t count, const Mat44& mat, float w)
+{
+	for (size_t i = 0; i < count; i++) {
+		float vx = x[i], vy = y[i], vz = z[i];
+		dst_x[i] = vx*mat._11 + vy*mat._12 + vz*mat._13 + mat._14 * w;
+		dst_y[i] = vx*mat._21 + vy*mat._22 + vz*mat._23 + mat._24 * w;
+		dst_z[i] = vx*mat._31 + vy*mat._32 + vz*mat._33 + mat._34 * w;
+	}
+}
+
+void mat44_mul_batch_scalar(Mat44 *dst, const Mat44 *a, const Mat44 *b, const U32 *index, size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+		dst[i] = mat44_mul_scalar(a[i], b[index ? index[i] : i]);
+}
+
+#ifdef HAS_SSE2
+
+void transform_aos_sse2(Vec3 *dst, const Vec3 *src, size_t count, const Mat44& mat, float w)
+{
+	size_t i = 0;
+
+	__m128 m[12];
+	math_broadcast_affine(m, mat, w);
+
+	for (; i + 4 <= count; i += 4) {
+		__m128 x, y, z, rx, ry, rz;
+		MATH_LOAD_VEC3X4(src + i, x, y, z);
+		MATH_TRANSFORM_X4(m, x, y, z, rx, ry, rz);
+		MATH_STORE_VEC3X4(dst + i, rx, ry, rz);
+	}
+
+	transform_aos_scalar(dst + i, src + i, count - i, mat, w);
+}
+
+void transform_soa_sse2(float *dst_x, float *dst_y, float *dst_z,
+		const float *x, const float *y, const float *z, size_t count, const Mat44& mat, float w)
+{
+	size_t i = 0;
+
+	__m128 m[12];
+	math_broadcast_affine(m, mat, w);
+
+	for (; i + 4 <= count; i += 4) {
+		__m128 vx = _mm_loadu_ps(x + i);
+		__m128 vy = _mm_loadu_ps(y + i);
+		__m128 vz = _mm_loadu_ps(z + i);
+		__m128 rx, ry, rz;
+		MATH_TRANSFORM_X4(m, vx, vy, vz, rx, ry, rz);
+		_mm_storeu_ps(dst_x + i, rx);
+		_mm_storeu_ps(dst_y + i, ry);
+		_mm_storeu_ps(dst_z + i, rz);
+	}
+
+	transform_soa_scalar(dst_x + i, dst_y + i, dst_z + i, x + i, y + i, z + i, count - i, mat, w);
+}
+
+void mat44_mul_batch_sse2(Mat44 *dst, const Mat44 *a, const Mat44 *b, const U32 *index, size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+		dst[i] = mat44_mul_sse2(a[i], b[index ? index[i] : i]);
+}
+
+#endif
+
+#ifdef HAS_DISPATCH_AVX
+
+CPU_TARGET("avx") void transform_soa_avx(float *dst_x, float *dst_y, float *dst_z,
+		const float *x, const float *y, const float *z, size_t count, const Mat44& mat, float w)
+{
+	size_t i = 0;
+
+	__m256 m11 = _mm256_set1_ps(mat._11), m12 = _mm256_set1_ps(mat._12), m13 = _mm256_set1_ps(mat._13), m14 = _mm256_set1_ps(mat._14 * w);
+	__m256 m21 = _mm256_set1_ps(mat._21), m22 = _mm256_set1_ps(mat._22), m23 = _mm256_set1_ps(mat._23), m24 = _mm256_set1_ps(mat._24 * w);
+	__m256 m31 = _mm256_set1_ps(mat._31), m32 = _mm256_set1_ps(mat._32), m33 = _mm256_set1_ps(mat._33), m34 = _mm256_set1_ps(mat._34 * w);
+
+	for (; i + 8 <= count; i += 8) {
+		__m256 vx = _mm256_loadu_ps(x + i);
+		__m256 vy = _mm256_loadu_ps(y + i);
+		__m256 vz = _mm256_loadu_ps(z + i);
+		__m256 rx = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(vx, m11), _mm256_mul_ps(vy, m12)), _mm256_mul_ps(vz, m13)), m14);
+		__m256 ry = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(vx, m21), _mm256_mul_ps(vy, m22)), _mm256_mul_ps(vz, m23)), m24);
+		__m256 rz = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(vx, m31), _mm256_mul_ps(vy, m32)), _mm256_mul_ps(vz, m33)), m34);
+		_mm256_storeu_ps(dst_x + i, rx);
+		_mm256_storeu_ps(dst_y + i, ry);
+		_mm256_storeu_ps(dst_z + i, rz);
+	}
+
+	transform_soa_scalar(dst_x + i, dst_y + i, dst_z + i, x + i, y + i, z + i, count - i, mat, w);
+}
+
+CPU_TARGET("avx") void mat44_mul_batch_avx(Mat44 *dst, const Mat44 *a, const Mat44 *b, const U32 *index, size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+		dst[i] = mat44_mul_avx(a[i], b[index ? index[i] : i]);
+}
+
+#endif
+
+#ifdef HAS_DISPATCH_AVX2
+
+// Fused multiply-add rounds once per term, so results differ from the other
+// paths in the last bit
+CPU_TARGET("avx2,fma") void transform_soa_avx2(float *dst_x, float *dst_y, float *dst_z,
+		const float *x, const float *y, const float *z, size_t count, const Mat44& mat, float w)
+{
+	size_t i = 0;
+
+	__m256 m11 = _mm256_set1_ps(mat._11), m12 = _mm256_set1_ps(mat._12), m13 = _mm256_set1_ps(mat._13), m14 = _mm256_set1_ps(mat._14 * w);
+	__m256 m21 = _mm256_set1_ps(mat._21), m22 = _mm256_set1_ps(mat._22), m23 = _mm256_set1_ps(mat._23), m24 = _mm256_set1_ps(mat._24 * w);
+	__m256 m31 = _mm256_set1_ps(mat._31), m32 = _mm256_set1_ps(mat._32), m33 = _mm256_set1_ps(mat._33), m34 = _mm256_set1_ps(mat._34 * w);
+
+	for (; i + 8 <= count; i += 8) {
+		__m256 vx = _mm256_loadu_ps(x + i);
+		__m256 vy = _mm256_loadu_ps(y + i);
+		__m256 vz = _mm256_loadu_ps(z + i);
+		__m256 rx = _mm256_fmadd_ps(vz, m13, _mm256_fmadd_ps(vy, m12, _mm256_fmadd_ps(vx, m11, m14)));
+		__m256 ry = _mm256_fmadd_ps(vz, m23, _mm256_fmadd_ps(vy, m22, _mm256_fmadd_ps(vx, m21, m24)));
+		__m256 rz = _mm256_fmadd_ps(vz, m33, _mm256_fmadd_ps(vy, m32, _mm256_fmadd_ps(vx, m31, m34)));
+		_mm256_storeu_ps(dst_x + i, rx);
+		_mm256_storeu_ps(dst_y + i, ry);
+		_mm256_storeu_ps(dst_z + i, rz);
+	}
+
+	transform_soa_scalar(dst_x + i, dst_y + i, dst_z + i, x + i, y + i, z + i, count - i, mat, w);
+}
+
+#endif
+
+#ifdef HAS_DISPATCH_AVX512
+
+CPU_TARGET("avx512f") void transform_soa_avx512(float *dst_x, float *dst_y, float *dst_z,
+		const float *x, const float *y, const float *z, size_t count, const Mat44& mat, float w)
+{
+	size_t i = 0;
+
+	__m512 m11 = _mm512_set1_ps(mat._11), m12 = _mm512_set1_ps(mat._12), m13 = _mm512_set1_ps(mat._13), m14 = _mm512_set1_ps(mat._14 * w);
+	__m512 m21 = _mm512_set1_ps(mat._21), m22 = _mm512_set1_ps(mat._22), m23 = _mm512_set1_ps(mat._23), m24 = _mm512_set1_ps(mat._24 * w);
+	__m512 m31 = _mm512_set1_ps(mat._31), m32 = _mm512_set1_ps(mat._32), m33 = _mm512_set1_ps(mat._33), m34 = _mm512_set1_ps(mat._34 * w);
+
+	for (; i + 16 <= count; i += 16) {
+		__m512 vx = _mm512_loadu_ps(x + i);
+		__m512 vy = _mm512_loadu_ps(y + i);
+		__m512 vz = _mm512_loadu_ps(z + i);
+		__m512 rx = _mm512_fmadd_ps(vz, m13, _mm512_fmadd_ps(vy, m12, _mm512_fmadd_ps(vx, m11, m14)));
+		__m512 ry = _mm512_fmadd_ps(vz, m23, _mm512_fmadd_ps(vy, m22, _mm512_fmadd_ps(vx, m21, m24)));
+		__m512 rz = _mm512_fmadd_ps(vz, m33, _mm512_fmadd_ps(vy, m32, _mm512_fmadd_ps(vx, m31, m34)));
+		_mm512_storeu_ps(dst_x + i, rx);
+		_mm512_storeu_ps(dst_y + i, ry);
+		_mm512_storeu_ps(dst_z + i, rz);
+	}
+
+	transform_soa_scalar(dst_x + i, dst_y + i, dst_z + i, x + i, y + i, z + i, count - i, mat, w);
+}
+
+#endif
+
+void mat44_transpose_batch(Mat44 *dst, const Mat44 *src, size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+		dst[i] = transpose(src[i]);
+}
+
+const Mat34 mat34_identity = {
+	1.0f, 0.0f, 0.0f, 0.0f,
+	0.0f, 1.0f, 0.0f, 0.0f,
+	0.0f, 0.0f, 1.0f, 0.0f,
+};
+
+Mat34 mat34(const Mat44& m)
+{
+	Mat34 ret;
+	memcpy(ret.data, m.data, sizeof(ret.data));
+	return ret;
+}
+
+Mat44 mat44(const Mat34& m)
+{
+	Mat44 ret;
+	memcpy(ret.data, m.data, sizeof(m.data));
+	ret._41 = 0.0f;
+	ret._42 = 0.0f;
+	ret._43 = 0.0f;
+	ret._44 = 1.0f;
+	return ret;
+}
+
+Mat33 mat33(const Mat34& m)
+{
+	Mat33 ret;
+
+	ret._11 = m._11; ret._12 = m._12; ret._13 = m._13;
+	ret._21 = m._21; ret._22 = m._22; ret._23 = m._23;
+	ret._31 = m._31; ret._32 = m._32; ret._33 = m._33;
+
+	return ret;
+}
+
+Mat33 transpose(const Mat33& a)
+{
+	Mat33 ret;
+
+	ret._11 = a._11; ret._12 = a._21; ret._13 = a._31;
+	ret._21 = a._12; ret._22 = a._22; ret._23 = a._32;
+	ret._31 = a._13; ret._32 = a._23; ret._33 = a._33;
+
+	return ret;
+}
+
+Mat34 mat34_translate(const Vec3& translation)
+{
+	Mat34 ret = mat34_identity;
+
+	ret._14 = translation.x;
+	ret._24 = translation.y;
+	ret._34 = translation.z;
+
+	return ret;
+}
+
+// Same convention as `operator*(Mat44, Mat44)`: `a * b` applies `a` first
+Mat34 mat34_mul_scalar(const Mat34& a, const Mat34& b)
+{
+	Mat34 ret;
+
+	ret._11 = a._11*b._11 + a._21*b._12 + a._31*b._13;
+	ret._12 = a._12*b._11 + a._22*b._12 + a._32*b._13;
+	ret._13 = a._13*b._11 + a._23*b._12 + a._33*b._13;
+	ret._14 = a._14*b._11 + a._24*b._12 + a._34*b._13 + b._14;
+
+	ret._21 = a._11*b._21 + a._21*b._22 + a._31*b._23;
+	ret._22 = a._12*b._21 + a._22*b._22 + a._32*b._23;
+	ret._23 = a._13*b._21 + a._23*b._22 + a._33*b._23;
+	ret._24 = a._14*b._21 + a._24*b._22 + a._34*b._23 + b._24;
+
+	ret._31 = a._11*b._31 + a._21*b._32 + a._31*b._33;
+	ret._32 = a._12*b._31 + a._22*b._32 + a._32*b._33;
+	ret._33 = a._13*b._31 + a._23*b._32 + a._33*b._33;
+	ret._34 = a._14*b._31 + a._24*b._32 + a._34*b._33 + b._34;
+
+	return ret;
+}
+
+#ifdef HAS_SSE2
+
+Mat34 mat34_mul_sse2(const Mat34& a, const Mat34& b)
+{
+	Mat34 ret;
+
+	__m128 a0 = _mm_loadu_ps(a.data + 0);
+	__m128 a1 = _mm_loadu_ps(a.data + 4);
+	__m128 a2 = _mm_loadu_ps(a.data + 8);
+	__m128 mask_w = _mm_castsi128_ps(_mm_set_epi32(-1, 0, 0, 0));
+
+	for (int i = 0; i < 3; i++) {
+		__m128 bi = _mm_loadu_ps(b.data + i * 4);
+		__m128 r = _mm_mul_ps(a0, _mm_shuffle_ps(bi, bi, _MM_SHUFFLE(0,0,0,0)));
+		r = _mm_add_ps(r, _mm_mul_ps(a1, _mm_shuffle_ps(bi, bi, _MM_SHUFFLE(1,1,1,1))));
+		r = _mm_add_ps(r, _mm_mul_ps(a2, _mm_shuffle_ps(bi, bi, _MM_SHUFFLE(2,2,2,2))));
+		r = _mm_add_ps(r, _mm_and_ps(bi, mask_w));
+		_mm_storeu_ps(ret.data + i * 4, r);
+	}
+
+	return ret;
+}
+
+#endif
+
+Mat34 operator*(const Mat34& a, const Mat34& b)
+{
+#if defined(HAS_SSE2)
+	return mat34_mul_sse2(a, b);
+#else
+	return mat34_mul_scalar(a, b);
+#endif
+}
+
+Mat34& operator*=(Mat34& a, const Mat34& b)
+{
+	a = a * b;
+	return a;
+}
+
+// Inverse of the 3x3 part from cofactors, the translation is rotated back
+Mat34 inverse(const Mat34& m)
+{
+	Mat34 ret;
+
+	float c11 = m._22*m._33 - m._23*m._32;
+	float c12 = m._23*m._31 - m._21*m._33;
+	float c13 = m._21*m._32 - m._22*m._31;
+
+	float det = m._11*c11 + m._12*c12 + m._13*c13;
+	assert(fabs(det) > 0.0f);
+
+	float idet = 1.0f / det;
+
+	ret._11 = c11 * idet;
+	ret._12 = (m._13*m._32 - m._12*m._33) * idet;
+	ret._13 = (m._12*m._23 - m._13*m._22) * idet;
+
+	ret._21 = c12 * idet;
+	ret._22 = (m._11*m._33 - m._13*m._31) * idet;
+	ret._23 = (m._13*m._21 - m._11*m._23) * idet;
+
+	ret._31 = c13 * idet;
+	ret._32 = (m._12*m._31 - m._11*m._32) * idet;
+	ret._33 = (m._11*m._22 - m._12*m._21) * idet;
+
+	ret._14 = -(ret._11*m._14 + ret._12*m._24 + ret._13*m._34);
+	ret._24 = -(ret._21*m._14 + ret._22*m._24 + ret._23*m._34);
+	ret._34 = -(ret._31*m._14 + ret._32*m._24 + ret._33*m._34);
+
+	return ret;
+}
+
+Vec3 operator*(const Vec3& vec, const Mat34& mat)
+{
+	Vec3 ret;
+
+	ret.x = vec.x*mat._11 + vec.y*mat._12 + vec.z*mat._13 + mat._14;
+	ret.y = vec.x*mat._21 + vec.y*mat._22 + vec.z*mat._23 + mat._24;
+	ret.z = vec.x*mat._31 + vec.y*mat._32 + vec.z*mat._33 + mat._34;
+
+	return ret;
+}
+
+Vec3 transform_direction(const Vec3& vec, const Mat34& mat)
+{
+	Vec3 ret;
+
+	ret.x = vec.x*mat._11 + vec.y*mat._12 + vec.z*mat._13;
+	ret.y = vec.x*mat._21 + vec.y*mat._22 + vec.z*mat._23;
+	ret.z = vec.x*mat._31 + vec.y*mat._32 + vec.z*mat._33;
+
+	return ret;
+}
+
+void mat34_mul_batch_scalar(Mat34 *dst, const Mat34 *a, const Mat34 *b, const U32 *index, size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+		dst[i] = mat34_mul_scalar(a[i], b[index ? index[i] : i]);
+}
+
+#ifdef HAS_SSE2
+
+void mat34_mul_batch_sse2(Mat34 *dst, const Mat34 *a, const Mat34 *b, const U32 *index, size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+		dst[i] = mat34_mul_sse2(a[i], b[index ? index[i] : i]);
+}
+
+#endif
+
+// Normal matrix (inverse transpose of the 3x3 part) of an affine transform.
+// Rotations with uniform scale `s` reuse the rotation part as A / s^2, other
+// transforms fall back to the adjugate divided by the determinant.
+Mat33 normal_matrix(const Mat34& m)
+{
+	Mat33 ret;
+
+	float s0 = m._11*m._11 + m._21*m._21 + m._31*m._31;
+	float s1 = m._12*m._12 + m._22*m._22 + m._32*m._32;
+	float s2 = m._13*m._13 + m._23*m._23 + m._33*m._33;
+	float d01 = m._11*m._12 + m._21*m._22 + m._31*m._32;
+	float d02 = m._11*m._13 + m._21*m._23 + m._31*m._33;
+	float d12 = m._12*m._13 + m._22*m._23 + m._32*m._33;
+
+	float tolerance = s0 * 1e-4f;
+	if (fabs(s1 - s0) < tolerance && fabs(s2 - s0) < tolerance
+			&& fabs(d01) < tolerance && fabs(d02) < tolerance && fabs(d12) < tolerance) {
+
+		assert(s0 > 0.0f);
+		float is = 1.0f / s0;
+
+		ret._11 = m._11 * is; ret._12 = m._12 * is; ret._13 = m._13 * is;
+		ret._21 = m._21 * is; ret._22 = m._22 * is; ret._23 = m._23 * is;
+		ret._31 = m._31 * is; ret._32 = m._32 * is; ret._33 = m._33 * is;
+
+		return ret;
+	}
+
+	ret._11 = m._22*m._33 - m._23*m._32;
+	ret._12 = m._23*m._31 - m._21*m._33;
+	ret._13 = m._21*m._32 - m._22*m._31;
+
+	ret._21 = m._13*m._32 - m._12*m._33;
+	ret._22 = m._11*m._33 - m._13*m._31;
+	ret._23 = m._12*m._31 - m._11*m._32;
+
+	ret._31 = m._12*m._23 - m._13*m._22;
+	ret._32 = m._13*m._21 - m._11*m._23;
+	ret._33 = m._11*m._22 - m._12*m._21;
+
+	float det = m._11*ret._11 + m._12*ret._12 + m._13*ret._13;
+	assert(fabs(det) > 0.0f);
+	float idet = 1.0f / det;
+
+	for (int i = 0; i < 9; i++)
+		ret.data[i] *= idet;
+
+	return ret;
+}
+
+void normal_matrix_batch(Mat33 *dst, const Mat34 *src, size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+		dst[i] = normal_matrix(src[i]);
+}
+
+// Recompute only the normal matrices whose transform differs from the copy in
+// `cached`, which is updated. Returns the number of matrices recomputed.
+U32 normal_matrix_batch_cached(Mat33 *dst, Mat34 *cached, const Mat34 *src, size_t count)
+{
+	U32 recomputed = 0;
+	for (size_t i = 0; i < count; i++) {
+		if (!memcmp(&cached[i], &src[i], sizeof(Mat34)))
+			continue;
+
+		cached[i] = src[i];
+		dst[i] = normal_matrix(src[i]);
+		recomputed++;
+	}
+	return recomputed;
+}
+
+// Quaternions: `a * b` applies `a` first, same as matrices
+
+const Quat quat_identity = { 0.0f, 0.0f, 0.0f, 1.0f };
+
+Quat quat(float x, float y, float z, float w)
+{
+	Quat ret;
+	ret.x = x;
+	ret.y = y;
+	ret.z = z;
+	ret.w = w;
+	return ret;
+}
+
+Quat quat_normalized_axis_angle(const Vec3& axis, float angle)
+{
+	ASSERT_NEARLY_NORMALIZED(axis);
+
+	float sin = sinf(angle * 0.5f);
+	float cos = cosf(angle * 0.5f);
+	return quat(axis.x * sin, axis.y * sin, axis.z * sin, cos);
+}
+
+Quat quat_axis_angle(const Vec3& axis, float angle)
+{
+	return quat_normalized_axis_angle(normalize(axis), angle);
+}
+
+Quat operator*(const Quat& a, const Quat& b)
+{
+	Quat ret;
+
+	ret.x = b.w*a.x + b.x*a.w + b.y*a.z - b.z*a.y;
+	ret.y = b.w*a.y - b.x*a.z + b.y*a.w + b.z*a.x;
+	ret.z = b.w*a.z + b.x*a.y - b.y*a.x + b.z*a.w;
+	ret.w = b.w*a.w - b.x*a.x - b.y*a.y - b.z*a.z;
+
+	return ret;
+}
+
+Quat& operator*=(Quat& a, const Quat& b)
+{
+	a = a * b;
+	return a;
+}
+
+Quat conjugate(const Quat& q)
+{
+	return quat(-q.x, -q.y, -q.z, q.w);
+}
+
+float dot(const Quat& a, const Quat& b)
+{
+	return a.x*b.x + a.y*b.y + a.z*b.z + a.w*b.w;
+}
+
+Quat normalize(const Quat& q)
+{
+	float len_sq = dot(q, q);
+	if (len_sq < 0.00000001f)
+		return quat_identity;
+
+	float inv = 1.0f / sqrtf(len_sq);
+	return quat(q.x * inv, q.y * inv, q.z * inv, q.w * inv);
+}
+
+Vec3 rotate(const Vec3& v, const Quat& q)
+{
+	Vec3 u = vec3(q.x, q.y, q.z);
+	Vec3 t = cross(u, v) * 2.0f;
+	return v + t * q.w + cross(u, t);
+}
+
+// Normalized lerp along the shorter arc, cheap and good enough for close
+// rotations such as consecutive animation keys
+Quat nlerp(const Quat& a, const Quat& b, float t)
+{
+	float tb = dot(a, b) < 0.0f ? -t : t;
+	float ta = 1.0f - t;
+	return normalize(quat(a.x*ta + b.x*tb, a.y*ta + b.y*tb, a.z*ta + b.z*tb, a.w*ta + b.w*tb));
+}
+
+Quat slerp(const Quat& a, const Quat& b, float t)
+{
+	float cos = dot(a, b);
+	float sign = 1.0f;
+	if (cos < 0.0f) {
+		cos = -cos;
+		sign = -1.0f;
+	}
+
+	// Nearly parallel, the sine below would lose all precision
+	if (cos > 0.9995f)
+		return nlerp(a, b, t);
+
+	float angle = acosf(cos);
+	float inv_sin = 1.0f / sinf(angle);
+	float ta = sinf((1.0f - t) * angle) * inv_sin;
+	float tb = sinf(t * angle) * inv_sin * sign;
+	return quat(a.x*ta + b.x*tb, a.y*ta + b.y*tb, a.z*ta + b.z*tb, a.w*ta + b.w*tb);
+}
+
+// Rotation of an orthonormal 3x3 part, scale must be removed beforehand
+Quat quat(const Mat33& m)
+{
+	Quat ret;
+	float trace = m._11 + m._22 + m._33;
+
+	if (trace > 0.0f) {
+		float s = sqrtf(trace + 1.0f) * 2.0f;
+		ret.w = 0.25f * s;
+		ret.x = (m._32 - m._23) / s;
+		ret.y = (m._13 - m._31) / s;
+		ret.z = (m._21 - m._12) / s;
+	} else if (m._11 > m._22 && m._11 > m._33) {
+		float s = sqrtf(1.0f + m._11 - m._22 - m._33) * 2.0f;
+		ret.w = (m._32 - m._23) / s;
+		ret.x = 0.25f * s;
+		ret.y = (m._12 + m._21) / s;
+		ret.z = (m._13 + m._31) / s;
+	} else if (m._22 > m._33) {
+		float s = sqrtf(1.0f + m._22 - m._11 - m._33) * 2.0f;
+		ret.w = (m._13 - m._31) / s;
+		ret.x = (m._12 + m._21) / s;
+		ret.y = 0.25f * s;
+		ret.z = (m._23 + m._32) / s;
+	} else {
+		float s = sqrtf(1.0f + m._33 - m._11 - m._22) * 2.0f;
+		ret.w = (m._21 - m._12) / s;
+		ret.x = (m._13 + m._31) / s;
+		ret.y = (m._23 + m._32) / s;
+		ret.z = 0.25f * s;
+	}
+
+	return normalize(ret);
+}
+
+const Trs trs_identity = {
+	{ 0.0f, 0.0f, 0.0f, 1.0f },
+	{ 0.0f, 0.0f, 0.0f },
+	{ 1.0f, 1.0f, 1.0f },
+};
+
+Trs trs(const Quat& rotation, const Vec3& translation, const Vec3& scale)
+{
+	Trs ret;
+	ret.rotation = rotation;
+	ret.translation = translation;
+	ret.scale = scale;
+	return ret;
+}
+
+// Decompose an affine transform without shear, a reflection is folded into
+// a negative x scale
+Trs trs(const Mat34& m)
+{
+	Trs ret;
+
+	ret.translation = vec3(m._14, m._24, m._34);
+	ret.scale.x = length(vec3(m._11, m._21, m._31));
+	ret.scale.y = length(vec3(m._12, m._22, m._32));
+	ret.scale.z = length(vec3(m._13, m._23, m._33));
+
+	Mat33 a = mat33(m);
+	float det = a._11*(a._22*a._33 - a._23*a._32)
+		+ a._12*(a._23*a._31 - a._21*a._33)
+		+ a._13*(a._21*a._32 - a._22*a._31);
+	if (det < 0.0f)
+		ret.scale.x = -ret.scale.x;
+
+	Vec3 inv_scale = vec3(1.0f / ret.scale.x, 1.0f / ret.scale.y, 1.0f / ret.scale.z);
+	for (int i = 0; i < 3; i++) {
+		a.data[i*3 + 0] *= inv_scale.x;
+		a.data[i*3 + 1] *= inv_scale.y;
+		a.data[i*3 + 2] *= inv_scale.z;
+	}
+	ret.rotation = quat(a);
+
+	return ret;
+}
+
+Mat34 mat34_from_trs_scalar(const Trs& t)
+{
+	Mat34 ret;
+	const Quat& q = t.rotation;
+
+	float x2 = q.x + q.x, y2 = q.y + q.y, z2 = q.z + q.z;
+	float xx = q.x*x2, yy = q.y*y2, zz = q.z*z2;
+	float xy = q.x*y2, xz = q.x*z2, yz = q.y*z2;
+	float wx = q.w*x2, wy = q.w*y2, wz = q.w*z2;
+
+	ret._11 = (1.0f - yy - zz) * t.scale.x;
+	ret._12 = (xy - wz) * t.scale.y;
+	ret._13 = (xz + wy) * t.scale.z;
+	ret._14 = t.translation.x;
+
+	ret._21 = (xy + wz) * t.scale.x;
+	ret._22 = (1.0f - xx - zz) * t.scale.y;
+	ret._23 = (yz - wx) * t.scale.z;
+	ret._24 = t.translation.y;
+
+	ret._31 = (xz - wy) * t.scale.x;
+	ret._32 = (yz + wx) * t.scale.y;
+	ret._33 = (1.0f - xx - yy) * t.scale.z;
+	ret._34 = t.translation.z;
+
+	return ret;
+}
+
+#ifdef HAS_SSE2
+
+// Each row is the identity row plus two broadcast quaternion components
+// times a signed shuffle of 2q, the w lane carries the translation
+Mat34 mat34_from_trs_sse2(const Trs& t)
+{
+	Mat34 ret;
+
+	__m128 q = _mm_loadu_ps(&t.rotation.x);
+	__m128 q2 = _mm_add_ps(q, q);
+	__m128 s = _mm_set_ps(0.0f, t.scale.z, t.scale.y, t.scale.x);
+
+	__m128 qx = _mm_shuffle_ps(q, q, _MM_SHUFFLE(0,0,0,0));
+	__m128 qy = _mm_shuffle_ps(q, q, _MM_SHUFFLE(1,1,1,1));
+	__m128 qz = _mm_shuffle_ps(q, q, _MM_SHUFFLE(2,2,2,2));
+
+	__m128 yxw = _mm_shuffle_ps(q2, q2, _MM_SHUFFLE(3,3,0,1));
+	__m128 zwx = _mm_shuffle_ps(q2, q2, _MM_SHUFFLE(3,0,3,2));
+	__m128 wzy = _mm_shuffle_ps(q2, q2, _MM_SHUFFLE(3,1,2,3));
+
+	// Sign vectors also clear the w lane
+	__m128 r0 = _mm_add_ps(
+		_mm_mul_ps(qy, _mm_mul_ps(yxw, _mm_set_ps(0.0f, 1.0f, 1.0f, -1.0f))),
+		_mm_mul_ps(qz, _mm_mul_ps(zwx, _mm_set_ps(0.0f, 1.0f, -1.0f, -1.0f))));
+	__m128 r1 = _mm_add_ps(
+		_mm_mul_ps(qx, _mm_mul_ps(yxw, _mm_set_ps(0.0f, -1.0f, -1.0f, 1.0f))),
+		_mm_mul_ps(qz, _mm_mul_ps(wzy, _mm_set_ps(0.0f, 1.0f, -1.0f, 1.0f))));
+	__m128 r2 = _mm_add_ps(
+		_mm_mul_ps(qx, _mm_mul_ps(zwx, _mm_set_ps(0.0f, -1.0f, 1.0f, 1.0f))),
+		_mm_mul_ps(qy, _mm_mul_ps(wzy, _mm_set_ps(0.0f, -1.0f, 1.0f, -1.0f))));
+
+	r0 = _mm_add_ps(_mm_mul_ps(_mm_add_ps(r0, _mm_set_ps(0.0f, 0.0f, 0.0f, 1.0f)), s), _mm_set_ps(t.translation.x, 0.0f, 0.0f, 0.0f));
+	r1 = _mm_add_ps(_mm_mul_ps(_mm_add_ps(r1, _mm_set_ps(0.0f, 0.0f, 1.0f, 0.0f)), s), _mm_set_ps(t.translation.y, 0.0f, 0.0f, 0.0f));
+	r2 = _mm_add_ps(_mm_mul_ps(_mm_add_ps(r2, _mm_set_ps(0.0f, 1.0f, 0.0f, 0.0f)), s), _mm_set_ps(t.translation.z, 0.0f, 0.0f, 0.0f));
+
+	_mm_storeu_ps(ret.data + 0, r0);
+	_mm_storeu_ps(ret.data + 4, r1);
+	_mm_storeu_ps(ret.data + 8, r2);
+
+	return ret;
+}
+
+#endif
+
+Mat34 mat34(const Trs& t)
+{
+#if defined(HAS_SSE2)
+	return mat34_from_trs_sse2(t);
+#else
+	return mat34_from_trs_scalar(t);
+#endif
+}
+
+Mat44 mat44(const Trs& t)
+{
+	return mat44(mat34(t));
+}
+
+// `a * b` applies `a` first. Exact when `b` has uniform scale, otherwise the
+// shear the result would need is dropped; compose in matrix form for those.
+Trs operator*(const Trs& a, const Trs& b)
+{
+	Trs ret;
+	ret.rotation = a.rotation * b.rotation;
+	ret.scale = a.scale * b.scale;
+	ret.translation = rotate(a.translation * b.scale, b.rotation) + b.translation;
+	return ret;
+}
+
+// Exact for uniform scale
+Trs inverse(const Trs& t)
+{
+	Trs ret;
+	ret.rotation = conjugate(t.rotation);
+	ret.scale = vec3(1.0f / t.scale.x, 1.0f / t.scale.y, 1.0f / t.scale.z);
+	ret.translation = rotate(-t.translation, ret.rotation) * ret.scale;
+	return ret;
+}
+
+Vec3 operator*(const Vec3& vec, const Trs& t)
+{
+	return rotate(vec * t.scale, t.rotation) + t.translation;
+}
+
+Vec3 lerp(const Vec3& a, const Vec3& b, float t)
+{
+	return a + (b - a) * t;
+}
+
+// Blend for animation sampling, the rotation takes the shorter arc
+Trs lerp(const Trs& a, const Trs& b, float t)
+{
+	Trs ret;
+	ret.rotation = nlerp(a.rotation, b.rotation, t);
+	ret.translation = lerp(a.translation, b.translation, t);
+	ret.scale = lerp(a.scale, b.scale, t);
+	return ret;
+}
+
+void mat34_from_trs_batch_scalar(Mat34 *dst, const Trs *src, size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+		dst[i] = mat34_from_trs_scalar(src[i]);
+}
+
+#ifdef HAS_SSE2
+
+void mat34_from_trs_batch_sse2(Mat34 *dst, const Trs *src, size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+		dst[i] = mat34_from_trs_sse2(src[i]);
+}
+
+#endif
+
+// World transforms of a node hierarchy stored parents first. `parent` holds
+// the index of each node's parent or `~0u` for roots. Composed in matrix form
+// so non-uniformly scaled parents stay exact.
+void trs_compose_batch(Mat34 *world, const Trs *local, const U32 *parent, size_t count)
+{
+	for (size_t i = 0; i < count; i++) {
+		Mat34 m = mat34(local[i]);
+		if (parent[i] != ~0u) {
+			assert(parent[i] < i);
+			m = m * world[parent[i]];
+		}
+		world[i] = m;
+	}
+}
+
+Dual_Quat dual_quat(const Quat& rotation, const Vec3& translation)
+{
+	Dual_Quat ret;
+	const Quat& r = rotation;
+	const Vec3& t = translation;
+
+	ret.real = r;
+	ret.dual.x = 0.5f * ( t.x*r.w + t.y*r.z - t.z*r.y);
+	ret.dual.y = 0.5f * (-t.x*r.z + t.y*r.w + t.z*r.x);
+	ret.dual.z = 0.5f * ( t.x*r.y - t.y*r.x + t.z*r.w);
+	ret.dual.w = -0.5f * (t.x*r.x + t.y*r.y + t.z*r.z);
+
+	return ret;
+}
+
+// Scale can't be represented and is dropped
+Dual_Quat dual_quat(const Mat34& m)
+{
+	Trs t = trs(m);
+	return dual_quat(t.rotation, t.translation);
+}
+
+Vec3 dual_quat_translation(const Dual_Quat& dq)
+{
+	const Quat& r = dq.real;
+	const Quat& d = dq.dual;
+	return vec3(
+		2.0f * (-d.w*r.x + d.x*r.w - d.y*r.z + d.z*r.y),
+		2.0f * (-d.w*r.y + d.x*r.z + d.y*r.w - d.z*r.x),
+		2.0f * (-d.w*r.z - d.x*r.y + d.y*r.x + d.z*r.w));
+}
+
+Vec3 operator*(const Vec3& vec, const Dual_Quat& dq)
+{
+	return rotate(vec, dq.real) + dual_quat_translation(dq);
+}
+
+// Bone palette for dual quaternion skinning, 32 bytes per bone instead of a
+// 3x4 matrix plus a normal matrix
+void dual_quat_batch(Dual_Quat *dst, const Mat34 *src, size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+		dst[i] = dual_quat(src[i]);
+}
+
+// Runtime dispatch of the batch kernels, see cpu.cpp
+
+struct Math_Kernels
+{
+	// Path the table was filled for
+	Cpu_Path path;
+
+	void (*transform_aos)(Vec3 *dst, const Vec3 *src, size_t count, const Mat44& mat, float w);
+	void (*transform_soa)(float *dst_x, float *dst_y, float *dst_z,
+		const float *x, const float *y, const float *z, size_t count, const Mat44& mat, float w);
+	void (*mat44_mul_batch)(Mat44 *dst, const Mat44 *a, const Mat44 *b, const U32 *index, size_t count);
+	void (*mat34_mul_batch)(Mat34 *dst, const Mat34 *a, const Mat34 *b, const U32 *index, size_t count);
+	void (*mat34_from_trs_batch)(Mat34 *dst, const Trs *src, size_t count);
+};
+
+// Best kernel for each operation at or below `path`
+void math_select_kernels(Math_Kernels *k, Cpu_Path path)
+{
+	k->path = path;
+	k->transform_aos = transform_aos_scalar;
+	k->transform_soa = transform_soa_scalar;
+	k->mat44_mul_batch = mat44_mul_batch_scalar;
+	k->mat34_mul_batch = mat34_mul_batch_scalar;
+	k->mat34_from_trs_batch = mat34_from_trs_batch_scalar;
+
+#ifdef HAS_SSE2
+	if (path >= Cpu_Path_SSE2) {
+		k->transform_aos = transform_aos_sse2;
+		k->transform_soa = transform_soa_sse2;
+		k->mat44_mul_batch = mat44_mul_batch_sse2;
+		k->mat34_mul_batch = mat34_mul_batch_sse2;
+		k->mat34_from_trs_batch = mat34_from_trs_batch_sse2;
+	}
+#endif
+#ifdef HAS_DISPATCH_AVX
+	if (path >= Cpu_Path_AVX) {
+		k->transform_soa = transform_soa_avx;
+		k->mat44_mul_batch = mat44_mul_batch_avx;
+	}
+#endif
+#ifdef HAS_DISPATCH_AVX2
+	if (path >= Cpu_Path_AVX2) {
+		k->transform_soa = transform_soa_avx2;
+	}
+#endif
+#ifdef HAS_DISPATCH_AVX512
+	if (path >= Cpu_Path_AVX512) {
+		k->transform_soa = transform_soa_avx512;
+	}
+#endif
+}
+
+static Math_Kernels math_kernel_table = { Cpu_Path_Count };
+
+const Math_Kernels *math_kernels()
+{
+	Cpu_Path path = cpu_path();
+	if (math_kernel_table.path != path)
+		math_select_kernels(&math_kernel_table, path);
+	return &math_kernel_table;
+}
+
+void transform_points(Vec3 *dst, const Vec3 *src, size_t count, const Mat44& mat)
+{
+	math_kernels()->transform_aos(dst, src, count, mat, 1.0f);
+}
+
+void transform_directions(Vec3 *dst, const Vec3 *src, size_t count, const Mat44& mat)
+{
+	math_kernels()->transform_aos(dst, src, count, mat, 0.0f);
+}
+
+void transform_points(Vec3 *dst, const Vec3 *src, size_t count, const Mat34& mat)
+{
+	transform_points(dst, src, count, mat44(mat));
+}
+
+void transform_directions(Vec3 *dst, const Vec3 *src, size_t count, const Mat34& mat)
+{
+	transform_directions(dst, src, count, mat44(mat));
+}
+
+void transform_points_soa(float *dst_x, float *dst_y, float *dst_z,
+		const float *x, const float *y, const float *z, size_t count, const Mat44& mat)
+{
+	math_kernels()->transform_soa(dst_x, dst_y, dst_z, x, y, z, count, mat, 1.0f);
+}
+
+void transform_directions_soa(float *dst_x, float *dst_y, float *dst_z,
+		const float *x, const float *y, const float *z, size_t count, const Mat44& mat)
+{
+	math_kernels()->transform_soa(dst_x, dst_y, dst_z, x, y, z, count, mat, 0.0f);
+}
+
+// dst[i] = a[i] * b[i], eg. palette = inv_bind * world
+void mat44_mul_batch(Mat44 *dst, const Mat44 *a, const Mat44 *b, size_t count)
+{
+	math_kernels()->mat44_mul_batch(dst, a, b, 0, count);
+}
+
+// dst[i] = a[i] * b[index[i]], for gathering eg. bone world transforms by node index
+void mat44_mul_batch_indexed(Mat44 *dst, const Mat44 *a, const Mat44 *b, const U32 *index, size_t count)
+{
+	math_kernels()->mat44_mul_batch(dst, a, b, index, count);
+}
+
+void mat34_mul_batch(Mat34 *dst, const Mat34 *a, const Mat34 *b, size_t count)
+{
+	math_kernels()->mat34_mul_batch(dst, a, b, 0, count);
+}
+
+void mat34_mul_batch_indexed(Mat34 *dst, const Mat34 *a, const Mat34 *b, const U32 *index, size_t count)
+{
+	math_kernels()->mat34_mul_batch(dst, a, b, index, count);
+}
+
+void mat34_from_trs_batch(Mat34 *dst, const Trs *src, size_t count)
+{
+	math_kernels()->mat34_from_trs_batch(dst, src, count);
+}
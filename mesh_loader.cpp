@@ -0,0 +1,258 @@
+// Asynchronous loading of cooked skinned mesh files. A worker thread reads
+// and validates the file, after which the GL thread uploads the buffers in
+// chunks limited by a per-frame byte budget.
+
+enum Mesh_Load_State
+{
+	Mesh_Load_Pending,
+	Mesh_Load_Uploading,
+	Mesh_Load_Done,
+	Mesh_Load_Failed,
+};
+
+struct Mesh_Load
+{
+	Mesh_Load *next;
+	char path[256];
+
+	// Only written by the GL thread
+	Mesh_Load_State state;
+
+	// Written by the worker before the load is queued for upload
+	bool valid;
+	char *file_data;
+
+	size_t vertex_size, index_size;
+	size_t vertex_uploaded, index_uploaded;
+
+	U32 bone_count;
+	Mat34 bone_inv[GL_MAX_BONES];
+	Mat34 bones[GL_MAX_BONES];
+
+	GL_Skinned_Mesh mesh;
+};
+
+struct Mesh_Load_Queue
+{
+	Mesh_Load *head, *tail;
+};
+
+struct Mesh_Loader
+{
+	Thread thread;
+	Mutex mutex;
+	Cond cond;
+	bool quit;
+
+	Mesh_Load_Queue read_queue;
+	Mesh_Load_Queue upload_queue;
+
+	// Load currently being uploaded, GL thread only
+	Mesh_Load *uploading;
+};
+
+static void mesh_load_queue_push(Mesh_Load_Queue *q, Mesh_Load *load)
+{
+	load->next = 0;
+	if (q->tail)
+		q->tail->next = load;
+	else
+		q->head = load;
+	q->tail = load;
+}
+
+static Mesh_Load *mesh_load_queue_pop(Mesh_Load_Queue *q)
+{
+	Mesh_Load *load = q->head;
+	if (load) {
+		q->head = load->next;
+		if (!q->head)
+			q->tail = 0;
+		load->next = 0;
+	}
+	return load;
+}
+
+static bool mesh_load_read(Mesh_Load *load)
+{
+	FILE *file = fopen(load->path, "rb");
+	if (!file)
+		return false;
+
+	fseek(file, 0, SEEK_END);
+	size_t size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+
+	char *buffer = (char*)malloc(size);
+	size_t read = buffer ? fread(buffer, 1, size, file) : 0;
+	fclose(file);
+
+	load->file_data = buffer;
+	if (read != size)
+		return false;
+
+	In_Stream ins = in_stream(buffer, size);
+
+	if (!stream_has(&ins, sizeof(U32)))
+		return false;
+	U32 bone_count = stream_read32(&ins);
+	if (bone_count > GL_MAX_BONES || !stream_has(&ins, sizeof(Mat34), bone_count * 2))
+		return false;
+
+	load->bone_count = bone_count;
+	stream_read_f32(&ins, load->bone_inv[0].data, 12 * bone_count);
+	stream_read_f32(&ins, load->bones[0].data, 12 * bone_count);
+
+	GL_Skinned_Mesh *mesh = &load->mesh;
+	if (!read_skinned_mesh(&ins, mesh))
+		return false;
+
+	load->vertex_size = sizeof(float) * skinned_vertex_size * mesh->vertex_count;
+	load->index_size = gl_type_size(mesh->index_type) * mesh->index_count;
+	return true;
+}
+
+static void mesh_loader_worker(void *user)
+{
+	Mesh_Loader *l = (Mesh_Loader*)user;
+
+	mutex_lock(&l->mutex);
+	for (;;) {
+		while (!l->read_queue.head && !l->quit)
+			cond_wait(&l->cond, &l->mutex);
+		if (l->quit)
+			break;
+
+		Mesh_Load *load = mesh_load_queue_pop(&l->read_queue);
+		mutex_unlock(&l->mutex);
+
+		load->valid = mesh_load_read(load);
+
+		mutex_lock(&l->mutex);
+		mesh_load_queue_push(&l->upload_queue, load);
+	}
+	mutex_unlock(&l->mutex);
+}
+
+bool mesh_loader_start(Mesh_Loader *l)
+{
+	memset(l, 0, sizeof(Mesh_Loader));
+	mutex_init(&l->mutex);
+	cond_init(&l->cond);
+	return thread_start(&l->thread, mesh_loader_worker, l);
+}
+
+void mesh_loader_stop(Mesh_Loader *l)
+{
+	mutex_lock(&l->mutex);
+	l->quit = true;
+	cond_broadcast(&l->cond);
+	mutex_unlock(&l->mutex);
+
+	thread_join(&l->thread);
+	cond_free(&l->cond);
+	mutex_free(&l->mutex);
+}
+
+Mesh_Load *mesh_loader_request(Mesh_Loader *l, const char *path)
+{
+	Mesh_Load *load = (Mesh_Load*)calloc(1, sizeof(Mesh_Load));
+	strncpy(load->path, path, sizeof(load->path) - 1);
+	load->state = Mesh_Load_Pending;
+
+	mutex_lock(&l->mutex);
+	mesh_load_queue_push(&l->read_queue, load);
+	cond_signal(&l->cond);
+	mutex_unlock(&l->mutex);
+
+	return load;
+}
+
+// Call once per frame on the GL thread. Uploads at most `byte_budget` bytes
+// of vertex and index data from loads that the worker has finished reading.
+void mesh_loader_upload(Mesh_Loader *l, size_t byte_budget)
+{
+	while (byte_budget > 0) {
+		Mesh_Load *load = l->uploading;
+
+		if (!load) {
+			mutex_lock(&l->mutex);
+			load = mesh_load_queue_pop(&l->upload_queue);
+			mutex_unlock(&l->mutex);
+
+			if (!load)
+				break;
+
+			if (!load->valid) {
+				free(load->file_data);
+				load->file_data = 0;
+				load->state = Mesh_Load_Failed;
+				continue;
+			}
+
+			GL_Skinned_Mesh *mesh = &load->mesh;
+			glGenBuffers(1, &mesh->vertex_buffer);
+			glGenBuffers(1, &mesh->index_buffer);
+
+			glBindBuffer(GL_ARRAY_BUFFER, mesh->vertex_buffer);
+			glBufferData(GL_ARRAY_BUFFER, load->vertex_size, 0, GL_STATIC_DRAW);
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->index_buffer);
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, load->index_size, 0, GL_STATIC_DRAW);
+
+			load->state = Mesh_Load_Uploading;
+			l->uploading = load;
+		}
+
+		GL_Skinned_Mesh *mesh = &load->mesh;
+
+		if (load->vertex_uploaded < load->vertex_size) {
+			size_t left = load->vertex_size - load->vertex_uploaded;
+			size_t bytes = left < byte_budget ? left : byte_budget;
+
+			glBindBuffer(GL_ARRAY_BUFFER, mesh->vertex_buffer);
+			glBufferSubData(GL_ARRAY_BUFFER, (GLintptr)load->vertex_uploaded, (GLsizeiptr)bytes,
+					(const char*)mesh->vertices + load->vertex_uploaded);
+
+			load->vertex_uploaded += bytes;
+			byte_budget -= bytes;
+		} else if (load->index_uploaded < load->index_size) {
+			size_t left = load->index_size - load->index_uploaded;
+			size_t bytes = left < byte_budget ? left : byte_budget;
+
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->index_buffer);
+			glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, (GLintptr)load->index_uploaded, (GLsizeiptr)bytes,
+					(const char*)mesh->indices + load->index_uploaded);
+
+			load->index_uploaded += bytes;
+			byte_budget -= bytes;
+		}
+
+		if (load->vertex_uploaded == load->vertex_size && load->index_uploaded == load->index_size) {
+			free(load->file_data);
+			load->file_data = 0;
+			mesh->vertices = 0;
+			mesh->indices = 0;
+
+			load->state = Mesh_Load_Done;
+			l->uploading = 0;
+		}
+	}
+
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
+// Free a load that has finished (`Mesh_Load_Done` or `Mesh_Load_Failed`)
+void mesh_load_free(Mesh_Load *load)
+{
+	assert(load->state == Mesh_Load_Done || load->state == Mesh_Load_Failed);
+
+	if (load->mesh.vertex_buffer)
+		glDeleteBuffers(1, &load->mesh.vertex_buffer);
+	if (load->mesh.index_buffer)
+		glDeleteBuffers(1, &load->mesh.index_buffer);
+
+	free(load->file_data);
+	free(load);
+}
+
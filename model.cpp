@@ -63,7 +63,7 @@ static Node* create_nodes_recursive(Temp_Allocator *t, Model_File_Data *data, ai
 	Node *node = &data->nodes[data->node_count++];
 
 	TEMP_COPY_STR(t, node->name, ai_node->mName.data);
-	node->transform = translate_matrix(ai_node->mTransformation);
+	node->transform = trs(mat34(translate_matrix(ai_node->mTransformation)));
 
 	U32 child_count = ai_node->mNumChildren;
 	node->child_count = child_count;
@@ -73,7 +73,7 @@ static Node* create_nodes_recursive(Temp_Allocator *t, Model_File_Data *data, ai
 
 	TEMP_ALLOC_N(t, node->meshes, mesh_count);
 	for (U32 meshI = 0; meshI < mesh_count; meshI++) {
-		TEMP_POINTER_SET(t, node->meshes[meshI], &data->meshes[meshI]);
+		TEMP_POINTER_SET(t, node->meshes[meshI], &data->meshes[ai_node->mMeshes[meshI]]);
 	}
 
 	TEMP_ALLOC_N(t, node->children, child_count);
@@ -187,9 +187,9 @@ Model_File_Data *load_model_file(const char *file, const Model_File_Settings *se
 			aiFace ai_face = ai_mesh->mFaces[faceI];
 			assert(ai_face.mNumIndices == 3);
 
-			out_index[0] = (U16)ai_face.mIndices[0];
-			out_index[1] = (U16)ai_face.mIndices[1];
-			out_index[2] = (U16)ai_face.mIndices[2];
+			out_index[0] = ai_face.mIndices[0];
+			out_index[1] = ai_face.mIndices[1];
+			out_index[2] = ai_face.mIndices[2];
 			out_index += 3;
 		}
 
@@ -207,7 +207,7 @@ Model_File_Data *load_model_file(const char *file, const Model_File_Settings *se
 			Bone *bone = &mesh->bones[boneI];
 
 			TEMP_COPY_STR(t, bone->name, ai_bone->mName.data);
-			bone->inv_bind_pose_transform = translate_matrix(ai_bone->mOffsetMatrix);
+			bone->inv_bind_pose_transform = mat34(translate_matrix(ai_bone->mOffsetMatrix));
 
 			U32 weight_count = (U32)ai_bone->mNumWeights;
 			for (U32 weightI = 0; weightI < weight_count; weightI++) {
@@ -4,7 +4,7 @@
 struct Bone
 {
 	const char *name;
-	Mat44 inv_bind_pose_transform;
+	Mat34 inv_bind_pose_transform;
 };
 
 struct Mesh
@@ -42,7 +42,7 @@ struct Node
 	Mesh **meshes;
 	U32 mesh_count;
 
-	Mat44 transform;
+	Trs transform;
 };
 
 struct Model_File_Data
@@ -5,10 +5,15 @@ struct Shader_Define
 	int value;
 };
 
+// Shaders use non-square matrices which need GLSL 1.20
+#define GLSL_VERSION 120
+
 void shader_source_defines(GLint shader, const char *source, int size, const Shader_Define *defines, size_t define_count)
 {
 	char prefix[2048], *prefix_ptr = prefix;
 
+	prefix_ptr += sprintf(prefix_ptr, "#version %d\n", GLSL_VERSION);
+
 	for (size_t i = 0; i < define_count; i++) {
 		const Shader_Define *d = &defines[i];
 		prefix_ptr += sprintf(prefix_ptr, "#define %s %d\n", d->name, d->value);
@@ -66,6 +71,14 @@ char* debug_read_file(const char *path)
 
 const char *GLSL_NUM_BONES = "NUM_BONES";
 const char *GLSL_NUM_WEIGHTS = "NUM_WEIGHTS";
+const char *GLSL_DUAL_QUATERNION = "DUAL_QUATERNION";
+
+enum Skinning_Mode
+{
+	Skinning_Mode_Linear,
+	Skinning_Mode_Dual_Quat,
+	Skinning_Mode_Count,
+};
 
 GLint skinned_frag_shader;
 struct Skinned_Shader
@@ -76,6 +89,7 @@ struct Skinned_Shader
 	GLint uViewProjection;
 	GLint uBones;
 	GLint uBonesIT;
+	GLint uBoneDQ;
 
 	GLint aVertex;
 	GLint aNormal;
@@ -84,7 +98,7 @@ struct Skinned_Shader
 	GLint aBoneWeight;
 };
 
-Skinned_Shader skinned_shaders[5];
+Skinned_Shader skinned_shaders[Skinning_Mode_Count][5];
 
 bool generate_shaders()
 {
@@ -96,13 +110,15 @@ bool generate_shaders()
 	if (!debug_compile_shader(skinned_frag_shader))
 		return false;
 
+	for (int modeI = 0; modeI < Skinning_Mode_Count; modeI++)
 	for (int weightI = 0; weightI < 5; weightI++) {
 		Shader_Define defines[] = {
 			{ GLSL_NUM_BONES, GL_MAX_BONES },
 			{ GLSL_NUM_WEIGHTS, weightI },
+			{ GLSL_DUAL_QUATERNION, modeI == Skinning_Mode_Dual_Quat },
 		};
 
-		Skinned_Shader *s = &skinned_shaders[weightI];
+		Skinned_Shader *s = &skinned_shaders[modeI][weightI];
 
 		GLuint vert_shader = glCreateShader(GL_VERTEX_SHADER);
 		s->vert_shader = vert_shader;
@@ -122,6 +138,7 @@ bool generate_shaders()
 		s->uViewProjection = glGetUniformLocation(program, "uViewProjection");
 		s->uBones = glGetUniformLocation(program, "uBones");
 		s->uBonesIT = glGetUniformLocation(program, "uBonesIT");
+		s->uBoneDQ = glGetUniformLocation(program, "uBoneDQ");
 
 		s->aVertex = glGetAttribLocation(program, "aVertex");
 		s->aNormal = glGetAttribLocation(program, "aNormal");
@@ -198,50 +215,145 @@ void load_skinned_mesh_to_gl(GL_Skinned_Mesh *mesh)
 	mesh->indices = 0;
 }
 
+// Vertices are 8 floats followed by the U8[4] bone index and weight words,
+// so only the float part of each vertex needs byte swapping.
+void write_skinned_vertices(Out_Stream *s, const float *vertices, U32 vertex_count)
+{
+#ifdef STREAM_BIG_ENDIAN
+	for (U32 i = 0; i < vertex_count; i++) {
+		const float *v = &vertices[i * skinned_vertex_size];
+		stream_write_f32(s, v, 8);
+		stream_write(s, v + 8, sizeof(float), skinned_vertex_size - 8);
+	}
+#else
+	stream_write(s, vertices, skinned_vertex_size * sizeof(float), vertex_count);
+#endif
+}
+
+float *read_skinned_vertices(In_Stream *s, U32 vertex_count)
+{
+	float *vertices = (float*)stream_skip(s, skinned_vertex_size * sizeof(float), vertex_count);
+#ifdef STREAM_BIG_ENDIAN
+	for (U32 i = 0; i < vertex_count; i++) {
+		float *v = &vertices[i * skinned_vertex_size];
+		endian_swap32(v, v, 8);
+	}
+#endif
+	return vertices;
+}
+
+void write_skinned_indices(Out_Stream *s, const void *indices, GLint index_type, U32 index_count)
+{
+	switch (index_type) {
+		case GL_UNSIGNED_BYTE:
+			stream_write(s, indices, 1, index_count);
+			break;
+		case GL_UNSIGNED_SHORT:
+			stream_write_u16(s, (const U16*)indices, index_count);
+			break;
+		case GL_UNSIGNED_INT:
+			stream_write_u32(s, (const U32*)indices, index_count);
+			break;
+		default:
+			assert(0 && "Unexpected index type");
+	}
+}
+
+void *read_skinned_indices(In_Stream *s, GLint index_type, U32 index_count)
+{
+	void *indices = stream_skip(s, gl_type_size(index_type), index_count);
+#ifdef STREAM_BIG_ENDIAN
+	if (index_type == GL_UNSIGNED_SHORT)
+		endian_swap16(indices, indices, index_count);
+	else if (index_type == GL_UNSIGNED_INT)
+		endian_swap32(indices, indices, index_count);
+#endif
+	return indices;
+}
+
 void write_skinned_mesh(Out_Stream *s, GL_Skinned_Mesh *mesh)
 {
-	stream_write(s, &mesh->vertex_count, sizeof(U32));
-	stream_write(s, &mesh->index_count, sizeof(U32));
-	stream_write(s, &mesh->index_type, sizeof(GLint));
-	stream_write(s, &mesh->bone_count, sizeof(U32));
-	stream_write(s, &mesh->weight_count, sizeof(U32));
-	stream_write(s, mesh->vertices, skinned_vertex_size * sizeof(float), mesh->vertex_count);
-	stream_write(s, mesh->indices, gl_type_size(mesh->index_type), mesh->index_count);
+	stream_write32(s, mesh->vertex_count);
+	stream_write32(s, mesh->index_count);
+	stream_write32(s, (U32)mesh->index_type);
+	stream_write32(s, mesh->bone_count);
+	stream_write32(s, mesh->weight_count);
+	write_skinned_vertices(s, (const float*)mesh->vertices, mesh->vertex_count);
+	write_skinned_indices(s, mesh->indices, mesh->index_type, mesh->index_count);
+}
+
+bool validate_skinned_indices(const void *indices, GLint index_type, U32 index_count, U32 vertex_count)
+{
+	U32 max_index = 0;
+	if (index_type == GL_UNSIGNED_BYTE) {
+		const U8 *ix = (const U8*)indices;
+		for (U32 i = 0; i < index_count; i++)
+			max_index = ix[i] > max_index ? ix[i] : max_index;
+	} else if (index_type == GL_UNSIGNED_SHORT) {
+		const U16 *ix = (const U16*)indices;
+		for (U32 i = 0; i < index_count; i++)
+			max_index = ix[i] > max_index ? ix[i] : max_index;
+	} else {
+		const U32 *ix = (const U32*)indices;
+		for (U32 i = 0; i < index_count; i++)
+			max_index = ix[i] > max_index ? ix[i] : max_index;
+	}
+	return index_count == 0 || max_index < vertex_count;
 }
 
-void read_skinned_mesh_to_gl(In_Stream *s, GL_Skinned_Mesh *mesh)
+// Parse and validate a cooked mesh without touching GL. The vertex and
+// index pointers are left pointing inside the stream data.
+bool read_skinned_mesh(In_Stream *s, GL_Skinned_Mesh *mesh)
 {
-	stream_read(s, &mesh->vertex_count, sizeof(U32));
-	stream_read(s, &mesh->index_count, sizeof(U32));
-	stream_read(s, &mesh->index_type, sizeof(GLint));
-	stream_read(s, &mesh->bone_count, sizeof(U32));
-	stream_read(s, &mesh->weight_count, sizeof(U32));
+	if (!stream_has(s, sizeof(U32), 5))
+		return false;
+
+	mesh->vertex_count = stream_read32(s);
+	mesh->index_count = stream_read32(s);
+	mesh->index_type = (GLint)stream_read32(s);
+	mesh->bone_count = stream_read32(s);
+	mesh->weight_count = stream_read32(s);
+
+	if (mesh->index_type != GL_UNSIGNED_BYTE
+			&& mesh->index_type != GL_UNSIGNED_SHORT
+			&& mesh->index_type != GL_UNSIGNED_INT)
+		return false;
+	if (mesh->weight_count > 4 || mesh->bone_count > GL_MAX_BONES)
+		return false;
+
+	if (!stream_has(s, skinned_vertex_size * sizeof(float), mesh->vertex_count))
+		return false;
+	mesh->vertices = read_skinned_vertices(s, mesh->vertex_count);
+
+	if (!stream_has(s, gl_type_size(mesh->index_type), mesh->index_count))
+		return false;
+	mesh->indices = read_skinned_indices(s, mesh->index_type, mesh->index_count);
+
+	return validate_skinned_indices(mesh->indices, mesh->index_type, mesh->index_count, mesh->vertex_count);
+}
 
-	mesh->vertices = stream_skip(s, skinned_vertex_size * sizeof(float), mesh->vertex_count);
-	mesh->indices = stream_skip(s, gl_type_size(mesh->index_type), mesh->index_count);
+bool read_skinned_mesh_to_gl(In_Stream *s, GL_Skinned_Mesh *mesh)
+{
+	if (!read_skinned_mesh(s, mesh))
+		return false;
 
 	do_load_skinned_mesh_to_gl(mesh);
 
 	mesh->vertices = 0;
 	mesh->indices = 0;
+	return true;
 }
 
-void draw_skinned_mesh(GL_Skinned_Mesh *mesh, const Mat44& viewProjection, const Mat44 *transforms)
+// Normal matrices of the last palette drawn with the cache, only bones whose
+// transform changed since then are recomputed.
+struct Skinned_Normal_Cache
 {
-	Skinned_Shader *s = &skinned_shaders[mesh->weight_count];
-
-	glUseProgram(s->program);
-	if (s->uViewProjection >= 0)
-		glUniformMatrix4fv(s->uViewProjection, 1, GL_FALSE, (const GLfloat*)&viewProjection);
-	if (s->uBones >= 0)
-		glUniformMatrix4fv(s->uBones, mesh->bone_count, GL_FALSE, (const GLfloat*)transforms);
-	if (s->uBonesIT >= 0) {
-		Mat44 transIt[GL_MAX_BONES];
-		for (U32 i = 0; i < mesh->bone_count; i++)
-			transIt[i] = transpose(inverse(transforms[i]));
-		glUniformMatrix4fv(s->uBonesIT, mesh->bone_count, GL_FALSE, (const GLfloat*)transIt);
-	}
+	Mat34 transforms[GL_MAX_BONES];
+	Mat33 normals[GL_MAX_BONES];
+};
 
+void bind_skinned_mesh(GL_Skinned_Mesh *mesh, Skinned_Shader *s)
+{
 	glBindBuffer(GL_ARRAY_BUFFER, mesh->vertex_buffer);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->index_buffer);
 
@@ -267,7 +379,51 @@ void draw_skinned_mesh(GL_Skinned_Mesh *mesh, const Mat44& viewProjection, const
 		glEnableVertexAttribArray(s->aBoneWeight);
 		glVertexAttribPointer(s->aBoneWeight, 4, GL_UNSIGNED_BYTE, GL_TRUE, sz, (const GLvoid*)(9 * sizeof(float)));
 	}
+}
+
+// `transforms` are the affine bone palette uploaded as `mat3x4`. Pass a
+// `normal_cache` per skinned instance to reuse normal matrices while the
+// pose is unchanged.
+void draw_skinned_mesh(GL_Skinned_Mesh *mesh, const Mat44& viewProjection, const Mat34 *transforms,
+		Skinned_Normal_Cache *normal_cache = 0)
+{
+	Skinned_Shader *s = &skinned_shaders[Skinning_Mode_Linear][mesh->weight_count];
+
+	glUseProgram(s->program);
+	if (s->uViewProjection >= 0)
+		glUniformMatrix4fv(s->uViewProjection, 1, GL_FALSE, (const GLfloat*)&viewProjection);
+	if (s->uBones >= 0)
+		glUniformMatrix3x4fv(s->uBones, mesh->bone_count, GL_FALSE, (const GLfloat*)transforms);
+	if (s->uBonesIT >= 0) {
+		Mat33 normals[GL_MAX_BONES];
+		const Mat33 *bone_normals = normals;
+
+		if (normal_cache) {
+			normal_matrix_batch_cached(normal_cache->normals, normal_cache->transforms, transforms, mesh->bone_count);
+			bone_normals = normal_cache->normals;
+		} else {
+			normal_matrix_batch(normals, transforms, mesh->bone_count);
+		}
+
+		glUniformMatrix3fv(s->uBonesIT, mesh->bone_count, GL_FALSE, (const GLfloat*)bone_normals);
+	}
+
+	bind_skinned_mesh(mesh, s);
+	glDrawElements(GL_TRIANGLES, mesh->index_count, mesh->index_type, (const GLvoid*)0);
+}
+
+// Dual quaternion skinning, `bones` is the palette from `dual_quat_batch`
+void draw_skinned_mesh_dq(GL_Skinned_Mesh *mesh, const Mat44& viewProjection, const Dual_Quat *bones)
+{
+	Skinned_Shader *s = &skinned_shaders[Skinning_Mode_Dual_Quat][mesh->weight_count];
+
+	glUseProgram(s->program);
+	if (s->uViewProjection >= 0)
+		glUniformMatrix4fv(s->uViewProjection, 1, GL_FALSE, (const GLfloat*)&viewProjection);
+	if (s->uBoneDQ >= 0)
+		glUniform4fv(s->uBoneDQ, mesh->bone_count * 2, (const GLfloat*)bones);
 
+	bind_skinned_mesh(mesh, s);
 	glDrawElements(GL_TRIANGLES, mesh->index_count, mesh->index_type, (const GLvoid*)0);
 }
 
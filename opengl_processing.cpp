@@ -1,3 +1,79 @@
+// Narrow 32-bit indices that are known to fit the smaller type
+
+void narrow_indices_u16_scalar(U16 *dst, const U32 *src, size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+		dst[i] = (U16)src[i];
+}
+
+void narrow_indices_u8_scalar(U8 *dst, const U32 *src, size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+		dst[i] = (U8)src[i];
+}
+
+#ifdef HAS_DISPATCH_SSE41
+
+CPU_TARGET("sse4.1") void narrow_indices_u16_sse41(U16 *dst, const U32 *src, size_t count)
+{
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m128i a = _mm_loadu_si128((const __m128i*)(src + i));
+		__m128i b = _mm_loadu_si128((const __m128i*)(src + i + 4));
+		_mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi32(a, b));
+	}
+	narrow_indices_u16_scalar(dst + i, src + i, count - i);
+}
+
+CPU_TARGET("sse4.1") void narrow_indices_u8_sse41(U8 *dst, const U32 *src, size_t count)
+{
+	size_t i = 0;
+	for (; i + 16 <= count; i += 16) {
+		__m128i a = _mm_loadu_si128((const __m128i*)(src + i));
+		__m128i b = _mm_loadu_si128((const __m128i*)(src + i + 4));
+		__m128i c = _mm_loadu_si128((const __m128i*)(src + i + 8));
+		__m128i d = _mm_loadu_si128((const __m128i*)(src + i + 12));
+		__m128i ab = _mm_packus_epi32(a, b);
+		__m128i cd = _mm_packus_epi32(c, d);
+		_mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(ab, cd));
+	}
+	narrow_indices_u8_scalar(dst + i, src + i, count - i);
+}
+
+#endif
+
+struct Processing_Kernels
+{
+	Cpu_Path path;
+
+	void (*narrow_indices_u16)(U16 *dst, const U32 *src, size_t count);
+	void (*narrow_indices_u8)(U8 *dst, const U32 *src, size_t count);
+};
+
+void processing_select_kernels(Processing_Kernels *k, Cpu_Path path)
+{
+	k->path = path;
+	k->narrow_indices_u16 = narrow_indices_u16_scalar;
+	k->narrow_indices_u8 = narrow_indices_u8_scalar;
+
+#ifdef HAS_DISPATCH_SSE41
+	if (path >= Cpu_Path_SSE41) {
+		k->narrow_indices_u16 = narrow_indices_u16_sse41;
+		k->narrow_indices_u8 = narrow_indices_u8_sse41;
+	}
+#endif
+}
+
+static Processing_Kernels processing_kernel_table = { Cpu_Path_Count };
+
+const Processing_Kernels *processing_kernels()
+{
+	Cpu_Path path = cpu_path();
+	if (processing_kernel_table.path != path)
+		processing_select_kernels(&processing_kernel_table, path);
+	return &processing_kernel_table;
+}
+
 
 bool make_skinned_mesh(GL_Skinned_Mesh *gl_mesh, Mesh *mesh)
 {
@@ -89,28 +165,124 @@ bool make_skinned_mesh(GL_Skinned_Mesh *gl_mesh, Mesh *mesh)
 		gl_mesh->index_type = GL_UNSIGNED_BYTE;
 
 		GLubyte *indices = (GLubyte*)malloc(index_count * sizeof(GLubyte));
-		for (U32 i = 0; i < index_count; i++) {
-			indices[i] = (GLubyte)wide_indices[i];
-		}
+		processing_kernels()->narrow_indices_u8(indices, wide_indices, index_count);
 		gl_mesh->indices = indices;
 	} else if (mesh->vertex_count < 1 << 16) {
 		gl_mesh->index_type = GL_UNSIGNED_SHORT;
 
 		GLushort *indices = (GLushort*)malloc(index_count * sizeof(GLushort));
-		for (U32 i = 0; i < index_count; i++) {
-			indices[i] = (GLushort)wide_indices[i];
-		}
+		processing_kernels()->narrow_indices_u16(indices, wide_indices, index_count);
 		gl_mesh->indices = indices;
 	} else {
 		gl_mesh->index_type = GL_UNSIGNED_INT;
-		
-		GLubyte *indices = (GLubyte*)malloc(index_count * sizeof(GLubyte));
-		for (U32 i = 0; i < index_count; i++) {
-			indices[i] = (GLubyte)wide_indices[i];
-		}
+
+		GLuint *indices = (GLuint*)malloc(index_count * sizeof(GLuint));
+		memcpy(indices, wide_indices, index_count * sizeof(GLuint));
 		gl_mesh->indices = indices;
 	}
 
 	return true;
 }
 
+
+// Fits a capsule per bone in the bone's bind space around the vertices it
+// moves with at least `min_weight`, so posing a capsule is just the bone's
+// world transform. The axis is the principal axis of the vertices, the ends
+// are pulled in as far as the radius allows. Bones without vertices get a
+// zero radius that never hits.
+bool fit_bone_capsules(Capsule *capsules, const Mesh *mesh, float min_weight)
+{
+	U32 bone_count = mesh->bone_count;
+	U32 weight_count = mesh->bones_per_vertex;
+	if (!weight_count)
+		return false;
+
+	U32 *bone_vertices = (U32*)malloc(sizeof(U32) * mesh->vertex_count * weight_count);
+	U32 *bone_first = (U32*)calloc(bone_count + 1, sizeof(U32));
+	Vec3 *points = (Vec3*)malloc(sizeof(Vec3) * mesh->vertex_count);
+	if (!bone_vertices || !bone_first || !points) {
+		free(bone_vertices);
+		free(bone_first);
+		free(points);
+		return false;
+	}
+
+	// Bucket vertices by bone
+	for (U32 i = 0; i < mesh->vertex_count * weight_count; i++) {
+		if (mesh->bone_weights[i] >= min_weight)
+			bone_first[mesh->bone_indices[i] + 1]++;
+	}
+	for (U32 i = 0; i < bone_count; i++)
+		bone_first[i + 1] += bone_first[i];
+	for (U32 i = 0; i < mesh->vertex_count * weight_count; i++) {
+		if (mesh->bone_weights[i] >= min_weight)
+			bone_vertices[bone_first[mesh->bone_indices[i]]++] = i / weight_count;
+	}
+	for (U32 i = bone_count; i > 0; i--)
+		bone_first[i] = bone_first[i - 1];
+	bone_first[0] = 0;
+
+	for (U32 boneI = 0; boneI < bone_count; boneI++) {
+		Capsule *c = &capsules[boneI];
+		U32 count = bone_first[boneI + 1] - bone_first[boneI];
+		if (count == 0) {
+			*c = capsule(vec3(0.0f, 0.0f, 0.0f), vec3(0.0f, 0.0f, 0.0f), 0.0f);
+			continue;
+		}
+
+		const Mat34& to_bone = mesh->bones[boneI].inv_bind_pose_transform;
+		Vec3 mean = vec3(0.0f, 0.0f, 0.0f);
+		for (U32 i = 0; i < count; i++) {
+			points[i] = mesh->positions[bone_vertices[bone_first[boneI] + i]] * to_bone;
+			mean += points[i];
+		}
+		mean = mean * (1.0f / (float)count);
+
+		float cov[6] = { 0 };
+		for (U32 i = 0; i < count; i++) {
+			Vec3 d = points[i] - mean;
+			cov[0] += d.x*d.x; cov[1] += d.x*d.y; cov[2] += d.x*d.z;
+			cov[3] += d.y*d.y; cov[4] += d.y*d.z; cov[5] += d.z*d.z;
+		}
+
+		// Power iteration for the principal axis
+		Vec3 axis = vec3(1.0f, 1.0f, 1.0f);
+		for (U32 iter = 0; iter < 32; iter++) {
+			Vec3 next = vec3(cov[0]*axis.x + cov[1]*axis.y + cov[2]*axis.z,
+					cov[1]*axis.x + cov[3]*axis.y + cov[4]*axis.z,
+					cov[2]*axis.x + cov[4]*axis.y + cov[5]*axis.z);
+			float len = length(next);
+			if (len <= 0.0f)
+				break;
+			axis = next * (1.0f / len);
+		}
+		axis = normalize(axis);
+
+		float radius_sq = 0.0f;
+		for (U32 i = 0; i < count; i++) {
+			Vec3 d = points[i] - mean;
+			float r2 = length_squared(d - axis * dot(d, axis));
+			if (r2 > radius_sq) radius_sq = r2;
+		}
+
+		// Pull the ends in while every point stays inside the end spheres
+		float lo = FLT_MAX, hi = -FLT_MAX;
+		for (U32 i = 0; i < count; i++) {
+			Vec3 d = points[i] - mean;
+			float s = dot(d, axis);
+			float r2 = length_squared(d - axis * s);
+			float cap = sqrtf(radius_sq - r2 > 0.0f ? radius_sq - r2 : 0.0f);
+			if (s + cap < lo) lo = s + cap;
+			if (s - cap > hi) hi = s - cap;
+		}
+		if (lo > hi)
+			lo = hi = (lo + hi) * 0.5f;
+
+		*c = capsule(mean + axis * lo, mean + axis * hi, sqrtf(radius_sq));
+	}
+
+	free(bone_vertices);
+	free(bone_first);
+	free(points);
+	return true;
+}
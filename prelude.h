@@ -8,6 +8,7 @@
 #include <string.h>
 #include <assert.h>
 #include <math.h>
+#include <float.h>
 #include <time.h>
 typedef int8_t I8;
 typedef uint8_t U8;
@@ -1,3 +1,14 @@
+#if defined(__BYTE_ORDER__) && defined(__ORDER_BIG_ENDIAN__)
+	#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+		#define STREAM_BIG_ENDIAN
+	#endif
+#elif defined(__BIG_ENDIAN__)
+	#define STREAM_BIG_ENDIAN
+#endif
+
+#if defined(STREAM_BIG_ENDIAN) && defined(__VSX__)
+#include <altivec.h>
+#endif
 
 struct Out_Stream
 {
@@ -11,9 +22,77 @@ struct In_Stream
 	size_t pos, size;
 };
 
-void stream_write(Out_Stream *s, void *data, size_t size, size_t count = 1)
+// Byte swapping helpers, `dst` and `src` may be the same buffer.
+// Cooked data is always little-endian so these are only called on big-endian hosts.
+
+void endian_swap16(void *dst, const void *src, size_t count)
+{
+	const U8 *s = (const U8*)src;
+	U8 *d = (U8*)dst;
+	size_t i = 0;
+
+	for (; i + 4 <= count; i += 4) {
+		U64 x;
+		memcpy(&x, s + i * 2, 8);
+		x = ((x & 0x00FF00FF00FF00FFull) << 8) | ((x >> 8) & 0x00FF00FF00FF00FFull);
+		memcpy(d + i * 2, &x, 8);
+	}
+
+	for (; i < count; i++) {
+		U8 a = s[i * 2 + 0], b = s[i * 2 + 1];
+		d[i * 2 + 0] = b;
+		d[i * 2 + 1] = a;
+	}
+}
+
+void endian_swap32(void *dst, const void *src, size_t count)
+{
+	const U8 *s = (const U8*)src;
+	U8 *d = (U8*)dst;
+	size_t i = 0;
+
+#if defined(STREAM_BIG_ENDIAN) && defined(__VSX__)
+	const vector unsigned char perm = { 3,2,1,0, 7,6,5,4, 11,10,9,8, 15,14,13,12 };
+	for (; i + 4 <= count; i += 4) {
+		vector unsigned char v = vec_xl(0, (unsigned char*)(s + i * 4));
+		vec_xst(vec_perm(v, v, perm), 0, (unsigned char*)(d + i * 4));
+	}
+#endif
+
+	for (; i + 2 <= count; i += 2) {
+		U64 x;
+		memcpy(&x, s + i * 4, 8);
+		x = ((x & 0x00FF00FF00FF00FFull) << 8) | ((x >> 8) & 0x00FF00FF00FF00FFull);
+		x = ((x & 0x0000FFFF0000FFFFull) << 16) | ((x >> 16) & 0x0000FFFF0000FFFFull);
+		memcpy(d + i * 4, &x, 8);
+	}
+
+	for (; i < count; i++) {
+		U8 a = s[i * 4 + 0], b = s[i * 4 + 1], c = s[i * 4 + 2], e = s[i * 4 + 3];
+		d[i * 4 + 0] = e;
+		d[i * 4 + 1] = c;
+		d[i * 4 + 2] = b;
+		d[i * 4 + 3] = a;
+	}
+}
+
+void endian_swap64(void *dst, const void *src, size_t count)
+{
+	const U8 *s = (const U8*)src;
+	U8 *d = (U8*)dst;
+
+	for (size_t i = 0; i < count; i++) {
+		U64 x;
+		memcpy(&x, s + i * 8, 8);
+		x = ((x & 0x00FF00FF00FF00FFull) << 8) | ((x >> 8) & 0x00FF00FF00FF00FFull);
+		x = ((x & 0x0000FFFF0000FFFFull) << 16) | ((x >> 16) & 0x0000FFFF0000FFFFull);
+		x = (x << 32) | (x >> 32);
+		memcpy(d + i * 8, &x, 8);
+	}
+}
+
+char *stream_reserve(Out_Stream *s, size_t bytes)
 {
-	size_t bytes = size * count;
 	size_t new_size = s->size + bytes;
 
 	if (new_size > s->capacity) {
@@ -22,8 +101,68 @@ void stream_write(Out_Stream *s, void *data, size_t size, size_t count = 1)
 		s->capacity = new_capacity;
 	}
 
-	memcpy(s->data + s->size, data, bytes);
+	char *ptr = s->data + s->size;
 	s->size = new_size;
+	return ptr;
+}
+
+void stream_write(Out_Stream *s, const void *data, size_t size, size_t count = 1)
+{
+	size_t bytes = size * count;
+	memcpy(stream_reserve(s, bytes), data, bytes);
+}
+
+// Typed writers: Data is stored little-endian regardless of the host
+
+void stream_write_u16(Out_Stream *s, const U16 *data, size_t count = 1)
+{
+#ifdef STREAM_BIG_ENDIAN
+	endian_swap16(stream_reserve(s, count * 2), data, count);
+#else
+	stream_write(s, data, 2, count);
+#endif
+}
+
+void stream_write_u32(Out_Stream *s, const U32 *data, size_t count = 1)
+{
+#ifdef STREAM_BIG_ENDIAN
+	endian_swap32(stream_reserve(s, count * 4), data, count);
+#else
+	stream_write(s, data, 4, count);
+#endif
+}
+
+void stream_write_u64(Out_Stream *s, const U64 *data, size_t count = 1)
+{
+#ifdef STREAM_BIG_ENDIAN
+	endian_swap64(stream_reserve(s, count * 8), data, count);
+#else
+	stream_write(s, data, 8, count);
+#endif
+}
+
+void stream_write_f32(Out_Stream *s, const float *data, size_t count = 1)
+{
+	stream_write_u32(s, (const U32*)data, count);
+}
+
+void stream_write32(Out_Stream *s, U32 value)
+{
+	stream_write_u32(s, &value);
+}
+
+void stream_write64(Out_Stream *s, U64 value)
+{
+	stream_write_u64(s, &value);
+}
+
+// Strings are stored as an U32 length followed by the characters and a
+// terminating null so that they can be referenced directly from the stream.
+void stream_write_str(Out_Stream *s, const char *str)
+{
+	U32 length = (U32)strlen(str);
+	stream_write32(s, length);
+	stream_write(s, str, 1, length + 1);
 }
 
 void stream_free(Out_Stream *s)
@@ -56,6 +195,68 @@ void *stream_skip(In_Stream *s, size_t size, size_t count = 1)
 	return ptr;
 }
 
+// Check that `count` elements of `size` bytes can be read without asserting
+bool stream_has(In_Stream *s, size_t size, size_t count = 1)
+{
+	size_t left = s->size - s->pos;
+	return size == 0 || count <= left / size;
+}
+
+void stream_read_u16(In_Stream *s, U16 *data, size_t count = 1)
+{
+	stream_read(s, data, 2, count);
+#ifdef STREAM_BIG_ENDIAN
+	endian_swap16(data, data, count);
+#endif
+}
+
+void stream_read_u32(In_Stream *s, U32 *data, size_t count = 1)
+{
+	stream_read(s, data, 4, count);
+#ifdef STREAM_BIG_ENDIAN
+	endian_swap32(data, data, count);
+#endif
+}
+
+void stream_read_u64(In_Stream *s, U64 *data, size_t count = 1)
+{
+	stream_read(s, data, 8, count);
+#ifdef STREAM_BIG_ENDIAN
+	endian_swap64(data, data, count);
+#endif
+}
+
+void stream_read_f32(In_Stream *s, float *data, size_t count = 1)
+{
+	stream_read_u32(s, (U32*)data, count);
+}
+
+U32 stream_read32(In_Stream *s)
+{
+	U32 value;
+	stream_read_u32(s, &value);
+	return value;
+}
+
+U64 stream_read64(In_Stream *s)
+{
+	U64 value;
+	stream_read_u64(s, &value);
+	return value;
+}
+
+// Returns a pointer to the null-terminated string inside the stream
+const char *stream_read_str(In_Stream *s, U32 *length = 0)
+{
+	U32 len = stream_read32(s);
+	const char *str = (const char*)stream_skip(s, 1, len + 1);
+	assert(str[len] == '\0');
+
+	if (length)
+		*length = len;
+	return str;
+}
+
 In_Stream in_stream(void *data, size_t size)
 {
 	In_Stream ret;
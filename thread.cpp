@@ -0,0 +1,247 @@
+#if !defined(_WIN32)
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+typedef void (*thread_func)(void *user);
+
+#if defined(_WIN32)
+
+struct Thread
+{
+	HANDLE handle;
+	thread_func func;
+	void *user;
+};
+
+struct Mutex
+{
+	CRITICAL_SECTION cs;
+};
+
+struct Cond
+{
+	CONDITION_VARIABLE cv;
+};
+
+static DWORD WINAPI thread_entry(LPVOID param)
+{
+	Thread *t = (Thread*)param;
+	t->func(t->user);
+	return 0;
+}
+
+bool thread_start(Thread *t, thread_func func, void *user)
+{
+	t->func = func;
+	t->user = user;
+	t->handle = CreateThread(0, 0, thread_entry, t, 0, 0);
+	return t->handle != 0;
+}
+
+void thread_join(Thread *t)
+{
+	WaitForSingleObject(t->handle, INFINITE);
+	CloseHandle(t->handle);
+	t->handle = 0;
+}
+
+void mutex_init(Mutex *m) { InitializeCriticalSection(&m->cs); }
+void mutex_free(Mutex *m) { DeleteCriticalSection(&m->cs); }
+void mutex_lock(Mutex *m) { EnterCriticalSection(&m->cs); }
+void mutex_unlock(Mutex *m) { LeaveCriticalSection(&m->cs); }
+
+void cond_init(Cond *c) { InitializeConditionVariable(&c->cv); }
+void cond_free(Cond *c) { }
+void cond_wait(Cond *c, Mutex *m) { SleepConditionVariableCS(&c->cv, &m->cs, INFINITE); }
+void cond_signal(Cond *c) { WakeConditionVariable(&c->cv); }
+void cond_broadcast(Cond *c) { WakeAllConditionVariable(&c->cv); }
+
+U32 thread_cpu_count()
+{
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return (U32)info.dwNumberOfProcessors;
+}
+
+#else
+
+struct Thread
+{
+	pthread_t handle;
+	thread_func func;
+	void *user;
+};
+
+struct Mutex
+{
+	pthread_mutex_t mutex;
+};
+
+struct Cond
+{
+	pthread_cond_t cond;
+};
+
+static void *thread_entry(void *param)
+{
+	Thread *t = (Thread*)param;
+	t->func(t->user);
+	return 0;
+}
+
+bool thread_start(Thread *t, thread_func func, void *user)
+{
+	t->func = func;
+	t->user = user;
+	return pthread_create(&t->handle, 0, thread_entry, t) == 0;
+}
+
+void thread_join(Thread *t)
+{
+	pthread_join(t->handle, 0);
+}
+
+void mutex_init(Mutex *m) { pthread_mutex_init(&m->mutex, 0); }
+void mutex_free(Mutex *m) { pthread_mutex_destroy(&m->mutex); }
+void mutex_lock(Mutex *m) { pthread_mutex_lock(&m->mutex); }
+void mutex_unlock(Mutex *m) { pthread_mutex_unlock(&m->mutex); }
+
+void cond_init(Cond *c) { pthread_cond_init(&c->cond, 0); }
+void cond_free(Cond *c) { pthread_cond_destroy(&c->cond); }
+void cond_wait(Cond *c, Mutex *m) { pthread_cond_wait(&c->cond, &m->mutex); }
+void cond_signal(Cond *c) { pthread_cond_signal(&c->cond); }
+void cond_broadcast(Cond *c) { pthread_cond_broadcast(&c->cond); }
+
+U32 thread_cpu_count()
+{
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+	return count > 0 ? (U32)count : 1;
+}
+
+#endif
+
+// Fixed set of worker threads that run one job at a time. A job is a number
+// of independent tasks that are handed out in order, the calling thread works
+// on them too and returns once all of them are done.
+
+#define THREAD_POOL_MAX_THREADS 64
+
+typedef void (*thread_task_func)(void *user, U32 task);
+
+struct Thread_Pool
+{
+	Thread threads[THREAD_POOL_MAX_THREADS];
+	U32 thread_count;
+
+	Mutex mutex;
+	Cond work_cond;
+	Cond done_cond;
+
+	thread_task_func func;
+	void *user;
+	U32 task_count;
+	U32 next_task;
+	U32 tasks_done;
+
+	bool quit;
+};
+
+// Runs tasks until the job runs out, called with the mutex locked
+static void thread_pool_work(Thread_Pool *pool)
+{
+	while (pool->next_task < pool->task_count) {
+		U32 task = pool->next_task++;
+		thread_task_func func = pool->func;
+		void *user = pool->user;
+
+		mutex_unlock(&pool->mutex);
+		func(user, task);
+		mutex_lock(&pool->mutex);
+
+		if (++pool->tasks_done == pool->task_count)
+			cond_broadcast(&pool->done_cond);
+	}
+}
+
+static void thread_pool_worker(void *user)
+{
+	Thread_Pool *pool = (Thread_Pool*)user;
+
+	mutex_lock(&pool->mutex);
+	for (;;) {
+		while (pool->next_task >= pool->task_count && !pool->quit)
+			cond_wait(&pool->work_cond, &pool->mutex);
+		if (pool->quit)
+			break;
+
+		thread_pool_work(pool);
+	}
+	mutex_unlock(&pool->mutex);
+}
+
+// Starts `thread_count` workers, 0 uses one less than the number of CPUs since
+// the calling thread takes part in every job
+bool thread_pool_start(Thread_Pool *pool, U32 thread_count)
+{
+	memset(pool, 0, sizeof(Thread_Pool));
+	if (thread_count == 0)
+		thread_count = thread_cpu_count() - 1;
+	if (thread_count > THREAD_POOL_MAX_THREADS)
+		thread_count = THREAD_POOL_MAX_THREADS;
+
+	mutex_init(&pool->mutex);
+	cond_init(&pool->work_cond);
+	cond_init(&pool->done_cond);
+
+	for (U32 i = 0; i < thread_count; i++) {
+		if (!thread_start(&pool->threads[i], thread_pool_worker, pool))
+			break;
+		pool->thread_count++;
+	}
+
+	return pool->thread_count == thread_count;
+}
+
+void thread_pool_stop(Thread_Pool *pool)
+{
+	mutex_lock(&pool->mutex);
+	pool->quit = true;
+	cond_broadcast(&pool->work_cond);
+	mutex_unlock(&pool->mutex);
+
+	for (U32 i = 0; i < pool->thread_count; i++)
+		thread_join(&pool->threads[i]);
+
+	cond_free(&pool->done_cond);
+	cond_free(&pool->work_cond);
+	mutex_free(&pool->mutex);
+	pool->thread_count = 0;
+}
+
+// Calls `func(user, task)` for every task in [0, task_count) and waits for all
+// of them. Without a pool the tasks run on the calling thread.
+void thread_pool_run(Thread_Pool *pool, thread_task_func func, void *user, U32 task_count)
+{
+	if (!pool || pool->thread_count == 0) {
+		for (U32 i = 0; i < task_count; i++)
+			func(user, i);
+		return;
+	}
+
+	mutex_lock(&pool->mutex);
+	pool->func = func;
+	pool->user = user;
+	pool->task_count = task_count;
+	pool->next_task = 0;
+	pool->tasks_done = 0;
+	cond_broadcast(&pool->work_cond);
+
+	thread_pool_work(pool);
+	while (pool->tasks_done < pool->task_count)
+		cond_wait(&pool->done_cond, &pool->mutex);
+
+	pool->task_count = 0;
+	pool->next_task = 0;
+	mutex_unlock(&pool->mutex);
+}
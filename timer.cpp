@@ -0,0 +1,52 @@
+#if defined(__APPLE__)
+#include <mach/mach_time.h>
+#endif
+
+// Monotonic high resolution timer
+
+#if defined(_WIN32)
+
+U64 timer_ticks()
+{
+	LARGE_INTEGER value;
+	QueryPerformanceCounter(&value);
+	return (U64)value.QuadPart;
+}
+
+double timer_seconds(U64 ticks)
+{
+	LARGE_INTEGER freq;
+	QueryPerformanceFrequency(&freq);
+	return (double)ticks / (double)freq.QuadPart;
+}
+
+#elif defined(__APPLE__)
+
+U64 timer_ticks()
+{
+	return mach_absolute_time();
+}
+
+double timer_seconds(U64 ticks)
+{
+	mach_timebase_info_data_t info;
+	mach_timebase_info(&info);
+	return (double)ticks * (double)info.numer / (double)info.denom * 1e-9;
+}
+
+#else
+
+U64 timer_ticks()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (U64)ts.tv_sec * 1000000000ull + (U64)ts.tv_nsec;
+}
+
+double timer_seconds(U64 ticks)
+{
+	return (double)ticks * 1e-9;
+}
+
+#endif
+
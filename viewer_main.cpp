@@ -7,6 +7,13 @@ int main(int argc, char **argv)
 {
 	GLFWwindow *window;
 
+	// --dq renders with dual quaternion skinning
+	bool dual_quat = false;
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--dq"))
+			dual_quat = true;
+	}
+
 	if (!glfwInit())
 		return 1;
 
@@ -29,33 +36,18 @@ int main(int argc, char **argv)
 		return 1;
 	}
 
-	GL_Skinned_Mesh gl_mesh = { 0 };
-
-	U32 bone_count;
-	Mat44 bones[64];
-	Mat44 bone_inv[64];
-
-	{
-		FILE *file = fopen("bin/out.bin", "rb");
-		fseek(file, 0, SEEK_END);
-		size_t size = ftell(file);
-		fseek(file, 0, SEEK_SET);
-		char *buffer = (char*)malloc(size);
-		fread(buffer, size, 1, file);
-		fclose(file);
-
-		In_Stream ins = in_stream(buffer, size);
-
-		stream_read(&ins, &bone_count, sizeof(U32));
-		stream_read(&ins, bone_inv, sizeof(Mat44), bone_count);
-		stream_read(&ins, bones, sizeof(Mat44), bone_count);
-		read_skinned_mesh_to_gl(&ins, &gl_mesh);
+	// Upload at most this many bytes of mesh data per frame
+	const size_t upload_budget = KB(256);
 
-		free(buffer);
+	Mesh_Loader loader;
+	if (!mesh_loader_start(&loader)) {
+		fprintf(stderr, "Could not start mesh loader\n");
+		return 1;
 	}
 
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	Mesh_Load *load = mesh_loader_request(&loader, "bin/out.bin");
+
+	Skinned_Normal_Cache normal_cache = { 0 };
 
 	float yaw = 0.0f;
 	float pitch = 0.0f;
@@ -77,6 +69,12 @@ int main(int argc, char **argv)
 		Mat44 world_to_screen = view * proj;
 		Mat44 screen_to_world = inverse(world_to_screen);
 
+		mesh_loader_upload(&loader, upload_budget);
+		if (load->state == Mesh_Load_Failed) {
+			fprintf(stderr, "Failed to load %s\n", load->path);
+			break;
+		}
+
 		glEnable(GL_DEPTH_TEST);
 
 		// Clearing the viewport
@@ -84,15 +82,18 @@ int main(int argc, char **argv)
 		glClearColor(0x64/255.0f, 0x95/255.0f, 0xED/255.0f, 1.0f);
 		glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
 
-		{
-			Mat44 bone_trans[64];
+		if (load->state == Mesh_Load_Done) {
+			Mat34 bone_trans[GL_MAX_BONES];
 			Mat44 vp = transpose(view * proj);
 
-			for (U32 i = 0; i < gl_mesh.bone_count; i++) {
-				const Mat44 &world = bones[i];
-				bone_trans[i] = transpose(bone_inv[i] * world);
+			mat34_mul_batch(bone_trans, load->bone_inv, load->bones, load->bone_count);
+			if (dual_quat) {
+				Dual_Quat bone_dq[GL_MAX_BONES];
+				dual_quat_batch(bone_dq, bone_trans, load->bone_count);
+				draw_skinned_mesh_dq(&load->mesh, vp, bone_dq);
+			} else {
+				draw_skinned_mesh(&load->mesh, vp, bone_trans, &normal_cache);
 			}
-			draw_skinned_mesh(&gl_mesh, vp, bone_trans);
 		}
 
 		glBindBuffer(GL_ARRAY_BUFFER, 0);
@@ -122,6 +123,10 @@ int main(int argc, char **argv)
 		glfwPollEvents();
 	}
 
+	mesh_loader_stop(&loader);
+	if (load->state == Mesh_Load_Done || load->state == Mesh_Load_Failed)
+		mesh_load_free(load);
+
 	glfwTerminate();
 	return 0;
 }